@@ -0,0 +1,22 @@
+#!/bin/bash
+# Client 12 sends bursts of messages through bridge 1 to client 11. Every
+# message has to arrive, forwarding bridge must not drop fragments of a
+# burst. Pass options for all nodes, e.g. --io=uring.
+SIZES="20000 60000 200000 1000000"
+COUNT=5
+
+(sleep 12; echo q) | ./stp "$@" --headless bulk/c11 > bulk-c11.log &
+(sleep 1; for s in $SIZES; do echo "bench 11 $s $COUNT"; sleep 2; done;
+ sleep 1; echo q) | ./stp "$@" --headless bulk/c12 > /dev/null &
+sleep 0.3
+(sleep 12; echo q) | ./stp "$@" --headless bulk/b1 > /dev/null &
+wait
+
+status=0
+for s in $SIZES; do
+    got=$(grep -c "Got: $s bytes" bulk-c11.log)
+    echo "$s bytes: $got/$COUNT"
+    [ "$got" == "$COUNT" ] || status=1
+done
+rm -f bulk-c11.log
+exit $status
@@ -4,12 +4,5 @@ if [ $# != 1 ]; then
     exit 1
 fi
 
-for file in $1/*
-do
-    echo "$file"
-    if [ -f $file ]; then
-        $COLORTERM -e "./stp $file"
-    fi
-done
-
-
+# Start all nodes in background, type 'q' to stop them
+exec ./stp --launch=$1
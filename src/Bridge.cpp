@@ -1,93 +1,108 @@
 #include "Bridge.h"
 #include "BridgePort.h"
 #include <boost/regex.hpp>
-#include <sys/signalfd.h>
+#include <cstring>
+#include <ctime>
 using namespace std;
 
-Bridge::Bridge(unsigned id, Display &display) 
-    : Node(id, display), m_rootID(id), m_rootPath(0), m_state(State::WORKING),
-      m_kill(false)
+static unsigned long now()
 {
-    pthread_mutexattr_init(&m_monitorAttr);
-    pthread_mutexattr_settype(&m_monitorAttr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&m_monitor, &m_monitorAttr);
-
-    pthread_create(&m_thread, nullptr, &Bridge::threadStart, this);
-
-    updateTitle();
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
 }
 
-void* Bridge::threadStart(void *bridge)
+static void appendNumber(string &msg, unsigned number)
 {
-    Bridge *b = reinterpret_cast<Bridge*>(bridge);
-    b->start();
-    return nullptr;
+    uint32_t value = htonl(number);
+    msg.append(reinterpret_cast<char*>(&value), 4);
 }
 
-Bridge::~Bridge() 
+// Bridge message: 'B' | type | root id | root path, bridges of version 2
+// also get sender's bridge id | port id
+static string bridgeMsg(char type, const PriorityVector &info, bool ids)
 {
-    pthread_mutex_destroy(&m_monitor);
-    pthread_mutexattr_destroy(&m_monitorAttr);
-   
-    // Kill thread
-    m_kill = true;
-    pthread_kill(m_thread, SIGUSR1);
+    string msg = "B";
+    msg += type;
+    appendNumber(msg, info.rootID);
+    appendNumber(msg, info.rootPath);
+    if (ids) {
+        appendNumber(msg, info.bridgeID);
+        appendNumber(msg, info.portID);
+    }
+    return msg;
+}
 
-    // Join it
-    pthread_join(m_thread, nullptr);
+static PriorityVector ownVector(unsigned id)
+{
+    PriorityVector info;
+    info.rootID = id;
+    info.rootPath = 0;
+    info.bridgeID = id;
+    info.portID = 0;
+    return info;
 }
 
-void Bridge::start()
+bool PriorityVector::operator<(const PriorityVector &other) const
 {
-    // Setup signal for receiving signals from bridge
-    sigset_t sigset;
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGUSR1);
+    if (rootID != other.rootID) return rootID < other.rootID;
+    if (rootPath != other.rootPath) return rootPath < other.rootPath;
+    if (bridgeID == UNKNOWN || other.bridgeID == UNKNOWN) return false;
+    if (bridgeID != other.bridgeID) return bridgeID < other.bridgeID;
+    return portID < other.portID;
+}
 
-    int sigFD = signalfd(-1, &sigset, 0);
-    if (sigFD == -1) return;
+bool PriorityVector::operator==(const PriorityVector &other) const
+{
+    return !(*this < other) && !(other < *this);
+}
 
-    bool setTimer = false;
+Bridge::Bridge(unsigned id, Display &display, EventLoop &loop) 
+    : Node(id, display, loop), m_root(ownVector(id)), m_rootPort(nullptr),
+      m_alternatePort(nullptr), m_state(State::WORKING), m_helloTime(2000),
+      m_maxAge(20000), m_forwardDelay(10000), m_helloTimer(0), m_timer(0)
+{
+    pthread_mutexattr_init(&m_monitorAttr);
+    pthread_mutexattr_settype(&m_monitorAttr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m_monitor, &m_monitorAttr);
 
-    while(!m_kill) {
-        fd_set readSet;
-        FD_ZERO(&readSet);
-        FD_SET(sigFD, &readSet);
+    updateTitle();
+}
 
-        timeval tm;
-        tm.tv_sec = 10;
-        tm.tv_usec = 0;
+Bridge::~Bridge() 
+{
+    m_loop.cancelTimer(m_timer);
+    m_loop.cancelTimer(m_helloTimer);
 
-        timeval *tmPtr = nullptr;
-        if (setTimer) tmPtr = &tm;
+    pthread_mutex_destroy(&m_monitor);
+    pthread_mutexattr_destroy(&m_monitorAttr);
+}
 
-        int result = select(sigFD + 1, &readSet, nullptr, nullptr, tmPtr);
-            
-        if (result == -1) {
-            //TODO Handle
-            return;
-        }
+void Bridge::setTimeout()
+{
+    BridgeMonitor m(m_monitor);
 
-        // Get command
-        if (FD_ISSET(sigFD, &readSet)) {
-            signalfd_siginfo si;
-            if (read(sigFD, &si, sizeof(si)) != sizeof(si)) {
-                //TODO Handle
-                return;
-            }
-            setTimer = true;
-        } else {
-            // We got timeout
-            setTimer = false;
-            timeout();
-        }
-    }
+    // Restart linking timeout
+    m_loop.cancelTimer(m_timer);
+    m_timer = m_loop.setTimer(m_forwardDelay, [this]() {
+        m_timer = 0;
+        timeout();
+    });
 }
 
-void Bridge::setTimeout()
+bool Bridge::removePort(Port *port)
 {
     BridgeMonitor m(m_monitor);
-    pthread_kill(m_thread, SIGUSR1);
+    m_forwarding.remove(port);
+    if (!Node::removePort(port)) return false;
+
+    if (port == m_alternatePort) m_alternatePort = nullptr;
+    if (port == m_rootPort)
+        failover();
+    else
+        updateRoot();
+    checkLinked();
+    return true;
 }
 
 Bridge::State Bridge::getState()
@@ -103,9 +118,9 @@ void Bridge::updateTitle()
     string title = " BRIDGE(";
     title += to_string(m_id);
     title += ") [root=";
-    title += to_string(m_rootID);
+    title += to_string(m_root.rootID);
     title += ", path=";
-    title += to_string(m_rootPath);
+    title += to_string(m_root.rootPath);
     title += "] State: ";
     switch(m_state) {
         case State::LINKING:
@@ -129,7 +144,7 @@ void Bridge::handleCommand(const string &command)
 
     // Port creation
     if (command.substr(0,5).compare("cport") == 0) {
-        r.assign("cport ([0-9]+) ?([0-9]+)?");
+        r.assign("cport ([0-9]+) ?([0-9]+)?( (tcp|udp|shm))?");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched) {
             auto port = new BridgePort(*this, stoul(cm[1]),
@@ -137,13 +152,15 @@ void Bridge::handleCommand(const string &command)
                                        BridgePort::Type::CLIENT);
             if (cm[2].matched)
                 port->setPort(stoul(cm[2]));
+            if (cm[4].matched)
+                port->setTransport(cm[4]);
             addPort(port);
         }
         return;
     }
 
     if (command.substr(0,5).compare("bport") == 0) {
-        r.assign("bport ([0-9]+) ?([0-9]+)?");
+        r.assign("bport ([0-9]+) ?([0-9]+)?( (tcp|udp|shm))?");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched) {
             auto port = new BridgePort(*this, stoul(cm[1]),
@@ -151,13 +168,16 @@ void Bridge::handleCommand(const string &command)
                                        BridgePort::Type::BRIDGE);
             if (cm[2].matched)
                 port->setPort(stoul(cm[2]));
+            if (cm[4].matched)
+                port->setTransport(cm[4]);
             addPort(port);
         }
         return;
     }
 
     if (command.substr(0,5).compare("cconn") == 0) {
-        r.assign("cconn ([0-9]+) ([0-9.]+):([0-9]+) ?([0-9]+)?");
+        r.assign("cconn ([0-9]+) ([0-9.]+):([0-9]+) ?([0-9]+)?"
+                 "( retry ([0-9]+))?( (tcp|udp|shm))?");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched && cm[2].matched && cm[3].matched) {
             auto port = new BridgePort(*this, stoul(cm[1]),
@@ -167,12 +187,17 @@ void Bridge::handleCommand(const string &command)
             port->setClientPort(stoul(cm[3]));
             if (cm[4].matched)
                 port->setPort(stoul(cm[4]));
+            if (cm[6].matched)
+                port->setRetryLimit(stoul(cm[6]));
+            if (cm[8].matched)
+                port->setTransport(cm[8]);
             addPort(port);
         }
     }
 
     if (command.substr(0,5).compare("bconn") == 0) {
-        r.assign("bconn ([0-9]+) ([0-9.]+):([0-9]+) ?([0-9]+)?");
+        r.assign("bconn ([0-9]+) ([0-9.]+):([0-9]+) ?([0-9]+)?"
+                 "( retry ([0-9]+))?( (tcp|udp|shm))?");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched && cm[2].matched && cm[3].matched) {
             auto port = new BridgePort(*this, stoul(cm[1]),
@@ -182,6 +207,10 @@ void Bridge::handleCommand(const string &command)
             port->setClientPort(stoul(cm[3]));
             if (cm[4].matched)
                 port->setPort(stoul(cm[4]));
+            if (cm[6].matched)
+                port->setRetryLimit(stoul(cm[6]));
+            if (cm[8].matched)
+                port->setTransport(cm[8]);
             addPort(port);
         }
     }
@@ -201,6 +230,37 @@ void Bridge::handleCommand(const string &command)
         }
     }
 
+    // Protocol timers
+    if (command.substr(0,6).compare("timers") == 0) {
+        r.assign("timers ([0-9]+) ([0-9]+) ([0-9]+)");
+        regex_match(command.c_str(), cm, r);
+        if (cm[1].matched && cm[2].matched && cm[3].matched) {
+            unsigned hello = stoul(cm[1]);
+            unsigned maxAge = stoul(cm[2]);
+            unsigned forwardDelay = stoul(cm[3]);
+
+            // Port information has to survive one lost hello
+            string error;
+            if (!hello)
+                error = "Hello time must be positive";
+            else if (!forwardDelay)
+                error = "Forward delay must be positive";
+            else if (maxAge < 2 * hello)
+                error = "Max age must be at least two hello times";
+            if (!error.empty()) {
+                m_display.setError(error);
+                m_display.queueUpdate();
+                return;
+            }
+
+            m_helloTime = hello;
+            m_maxAge = maxAge;
+            m_forwardDelay = forwardDelay;
+            scheduleHello();
+        }
+        return;
+    }
+
     // Kill port
     if (command.substr(0,4).compare("kill") == 0) {
         r.assign("kill ([0-9]+)");
@@ -217,120 +277,394 @@ void Bridge::handleCommand(const string &command)
     }
 }
 
-void Bridge::initialize() {
+void Bridge::connected(BridgePort *senderPort)
+{
     BridgeMonitor m(m_monitor);
 
-    // Reset statistics only in WORKING state
-    if (m_state == State::WORKING) {
-        m_rootPath = 0;
-        m_rootID = m_id;
+    // New neighbour is linked on its own port, other ports keep
+    // forwarding
+    senderPort->resetInfo();
+    senderPort->markClosed();
+    senderPort->updatePortLabel();
+    offer(senderPort);
+    startLinking();
+}
+
+void Bridge::startLinking()
+{
+    // Restart forward delay for ports which are not linked yet
+    if (m_state != State::LINKING) {
+        m_state = State::LINKING;
+        updateTitle();
     }
+    setTimeout();
+}
 
-    // Prepare message
-    string msg = "B";
-    msg += (char)(0);
-    uint32_t rootID = htonl(m_rootID);
-    uint32_t rootPath = htonl(m_rootPath + 1);
-    msg.append(reinterpret_cast<char*>(&rootID), 4);
-    msg.append(reinterpret_cast<char*>(&rootPath), 4);
+PriorityVector Bridge::getOffer(BridgePort *port) const
+{
+    PriorityVector info;
+    info.rootID = m_root.rootID;
+    info.rootPath = m_root.rootPath + 1;
+    info.bridgeID = m_id;
+    info.portID = port->getID();
+    return info;
+}
+
+bool Bridge::isDesignated(BridgePort *port) const
+{
+    if (port == m_rootPort) return false;
 
-    // Send over all bridge ports
+    // Port which has heard nothing keeps bridge's own id. Equal paths are
+    // decided by bridge ids and parallel links by port ids.
+    if (port->getRootID() == m_id && port->getRootPath() == 0) return true;
+    return getOffer(port) < port->getInfo();
+}
+
+void Bridge::send(BridgePort *port, char type, const PriorityVector &info)
+{
+    port->sendMessage(bridgeMsg(type, info, port->getVersion() >= 2), true);
+}
+
+void Bridge::offer(BridgePort *port)
+{
+    // Designated port asks peer of version 2 for agreement, others only
+    // announce root
+    char type = port->getVersion() >= 2 && isDesignated(port) ? 3 : 0;
+    send(port, type, getOffer(port));
+}
+
+void Bridge::agree()
+{
+    if (!m_rootPort) return;
+
+    // Other ports are synced (closed or agreed for current root), so root
+    // port can be opened at once
+    m_rootPort->markOpened();
+    if (m_rootPort->getVersion() >= 2) send(m_rootPort, 4, m_root);
+}
+
+void Bridge::checkLinked()
+{
+    // Root port and designated ports forward once peers agree, ports of
+    // version 1 peers wait for timeout
+    bool linked = true;
     for(auto &port : m_ports) {
         BridgePort *bridgePort = static_cast<BridgePort*>(port.second);
-        if (bridgePort->getType() == BridgePort::Type::CLIENT) {
-            bridgePort->markOpened();
-        } else { 
-            if (m_state == State::WORKING) {
-                bridgePort->setRootID(m_id);
-                bridgePort->setRootPath(0);
-            }
-            bridgePort->markClosed();
-            bridgePort->updatePortLabel();
-            port.second->sendMessage(msg, true);
+        if (bridgePort->getType() == BridgePort::Type::CLIENT ||
+            !bridgePort->isConnected()) continue;
+        if (bridgePort->getVersion() < 2) {
+            if (m_state == State::LINKING) return;
+            continue;
         }
+
+        if ((bridgePort == m_rootPort || isDesignated(bridgePort)) &&
+            !bridgePort->isOpened())
+            linked = false;
     }
 
-    //Set state to linking and reset timeout
-    m_state = State::LINKING;
-    updateTitle();
-    setTimeout();
+    if (!linked) {
+        if (m_state == State::WORKING) startLinking();
+        return;
+    }
+    if (m_state != State::LINKING) return;
+
+    m_loop.cancelTimer(m_timer);
+    m_timer = 0;
+    timeout();
 }
 
-void Bridge::sendToOtherPorts(Port *senderPort, const std::string &msg,
+void Bridge::sendToOtherPorts(Port *senderPort, const char *msg, size_t size,
                               bool force, bool clientPorts) {
     BridgeMonitor m(m_monitor);
+
+    // Messages are only queued, congested ports drop not forced messages
     for(auto &port : m_ports) {
         BridgePort *bridgePort = static_cast<BridgePort*>(port.second);
         if (bridgePort->getType() == BridgePort::Type::CLIENT &&
             !clientPorts) continue;
         if (bridgePort != senderPort)
-            port.second->sendMessage(msg, force);
+            port.second->sendMessage(msg, size, force);
     }
 }
 
-void Bridge::rootMsg(Port *senderPort, unsigned rootID, unsigned rootPath)
+void Bridge::forward(BridgePort *senderPort, const char *msg, size_t size)
 {
     BridgeMonitor m(m_monitor);
 
-    if (rootID < m_rootID || (rootID == m_rootID && rootPath < m_rootPath)) {
-        m_rootID = rootID;
-        m_rootPath = rootPath;
-        updateTitle();
+    // Every client frame starts with type, source and destination
+    uint32_t source;
+    uint32_t dest;
+    memcpy(&source, msg + 1, 4);
+    memcpy(&dest, msg + 5, 4);
+    source = ntohl(source);
+    dest = ntohl(dest);
+
+    unsigned long time = now();
+    m_forwarding.learn(source, senderPort, time);
+
+    Port *port = m_forwarding.find(dest, time);
+    if (!port) {
+        sendToOtherPorts(senderPort, msg, size, false, true);
+        return;
     }
 
-    // Prepare message
-    string msg = "B";
-    msg += (char)(0);
-    uint32_t msgRootID = htonl(rootID);
-    uint32_t msgRootPath = htonl(rootPath + 1);
-    msg.append(reinterpret_cast<char*>(&msgRootID), 4);
-    msg.append(reinterpret_cast<char*>(&msgRootPath), 4);
+    // Destination is on sender's side of the tree
+    if (port != senderPort) port->sendMessage(msg, size, false);
+}
+
+void Bridge::updateRoot(BridgePort *alternate)
+{
+    // Root port and alternate ports heard root through other bridges,
+    // designated ports may have heard it through this one. Second best
+    // of them is kept for failover.
+    //
+    // Information never passes back through this bridge: bridges do not
+    // announce root on port they heard it from, and information of peer
+    // which agreed to this bridge's offer is dropped in agreementMsg().
+    // So information kept on a port was heard by its peer through other
+    // bridges, and stays valid as alternate when this bridge's root
+    // information gets worse.
+    //
+    // Roles depend on root information being chosen: with worse root
+    // some designated ports become candidates. Selection is repeated
+    // with chosen root until it does not change.
+    BridgePort *oldRootPort = m_rootPort;
+    PriorityVector oldRoot = m_root;
+    for(size_t round = 0; round <= m_ports.size(); round++) {
+        BridgePort *rootPort = nullptr;
+        BridgePort *alternatePort = nullptr;
+        PriorityVector root = ownVector(m_id);
+        for(auto &port : m_ports) {
+            BridgePort *bridgePort = static_cast<BridgePort*>(port.second);
+            if (bridgePort->getType() == BridgePort::Type::CLIENT ||
+                !bridgePort->isConnected() || isDesignated(bridgePort) ||
+                !(bridgePort->getInfo() < ownVector(m_id)))
+                continue;
+            if (bridgePort->getInfo() < root) {
+                alternatePort = rootPort;
+                root = bridgePort->getInfo();
+                rootPort = bridgePort;
+            } else if (!alternatePort ||
+                       bridgePort->getInfo() < alternatePort->getInfo()) {
+                alternatePort = bridgePort;
+            }
+        }
+
+        bool stable = rootPort == m_rootPort && root == m_root;
+        m_rootPort = rootPort;
+        m_root = root;
+        m_alternatePort = alternatePort;
+        if (stable) break;
+    }
+
+    // Alternate port taking over lost root port needs no sync
+    bool changed = m_rootPort != oldRootPort;
+    bool moved = changed && m_rootPort && m_rootPort != alternate;
+    if (!changed && m_root == oldRoot) return;
+
+    updateTitle();
+    scheduleHello();
+
+    // Sync: ports agreed for old root port are closed before new one is
+    // opened. Otherwise only ports which stopped being designated are
+    // closed. Neighbours learn new information either way.
+    for(auto &port : m_ports) {
+        BridgePort *bridgePort = static_cast<BridgePort*>(port.second);
+        if (bridgePort->getType() == BridgePort::Type::CLIENT ||
+            bridgePort == m_rootPort) continue;
+        if (moved || !isDesignated(bridgePort)) block(bridgePort);
+        offer(bridgePort);
+    }
+    if (changed) agree();
+}
 
-    sendToOtherPorts(senderPort, msg, true, false);
+void Bridge::failover()
+{
+    BridgePort *alternate = m_alternatePort;
+    m_rootPort = nullptr;
+    updateRoot(alternate);
+
+    // Peer of version 1 opens its side on request
+    if (m_rootPort && m_rootPort == alternate &&
+        m_rootPort->getVersion() < 2)
+        send(m_rootPort, 1, PriorityVector());
 }
 
-void Bridge::disconnected(BridgePort *senderPort)
+void Bridge::block(BridgePort *port)
+{
+    // Clients behind closed port are learned again when it opens
+    port->markClosed();
+    m_forwarding.remove(port);
+}
+
+void Bridge::infoMsg(BridgePort *senderPort, const PriorityVector &info,
+                     bool proposal)
 {
     BridgeMonitor m(m_monitor);
-    // For now if disconnected and it's root port reinitialize algorithm
-    if (senderPort->getRootID() == m_rootID &&
-        senderPort->getRootPath() == m_rootPath)
-        initialize();
+
+    // Bridges of version 1 pass on worse information too while linking,
+    // only their best is kept. Others announce what they use.
+    bool legacy = senderPort->getVersion() < 2 &&
+                  m_state == State::LINKING;
+    if (!legacy || info < senderPort->getInfo())
+        senderPort->refreshInfo(info);
+
+    // Root port is chosen again, only ports whose role changes are
+    // closed
+    updateRoot();
+
+    if (senderPort == m_rootPort) {
+        if (proposal && info == m_root) agree();
+    } else if (isDesignated(senderPort)) {
+        // Peer which has not heard about root learns it from this port
+        if (!legacy) offer(senderPort);
+    } else if (proposal) {
+        agreeBlocked(senderPort, info);
+    } else {
+        block(senderPort);
+    }
+    checkLinked();
 }
 
-void Bridge::timeout()
+void Bridge::agreeBlocked(BridgePort *port, const PriorityVector &info)
+{
+    // Alternate port stays closed, so peer's port can forward at once
+    block(port);
+    send(port, 4, info);
+}
+
+void Bridge::agreementMsg(BridgePort *senderPort, const PriorityVector &info)
 {
     BridgeMonitor m(m_monitor);
 
-    // Open all non-root, not active ports
+    // Agreement for older root information is ignored
+    if (!(info == getOffer(senderPort)) || !isDesignated(senderPort))
+        return;
+
+    // Peer uses this bridge's root information now, what it announced
+    // before must not become root or alternate of this bridge
+    senderPort->resetInfo();
+    senderPort->updatePortLabel();
+    senderPort->markOpened();
+    checkLinked();
+}
+
+void Bridge::helloMsg(BridgePort *senderPort, const PriorityVector &info)
+{
+    BridgeMonitor m(m_monitor);
+
+    // Changed information is handled like any root message, so roots
+    // and alternates stay ranked
+    if (!(info == senderPort->getInfo()))
+        infoMsg(senderPort, info, false);
+    else if (info.rootID == m_root.rootID)
+        senderPort->refreshInfo(info);
+
+    // Hello from root is passed down the tree
+    if (senderPort == m_rootPort && info == m_root)
+        sendHello(senderPort, info);
+}
+
+void Bridge::scheduleHello()
+{
+    BridgeMonitor m(m_monitor);
+
+    // Only root sends hellos on its own
+    m_loop.cancelTimer(m_helloTimer);
+    m_helloTimer = 0;
+    if (m_root.rootID != m_id) return;
+
+    m_helloTimer = m_loop.setTimer(m_helloTime, [this]() {
+        m_helloTimer = 0;
+        sendHello(nullptr, ownVector(m_id));
+        scheduleHello();
+    });
+}
+
+void Bridge::sendHello(BridgePort *senderPort, const PriorityVector &info)
+{
+    PriorityVector hello = info;
+    hello.rootPath = info.rootPath + 1;
+    hello.bridgeID = m_id;
+
+    // Bridges of version 1 take every message as topology change. Hellos
+    // go only down the tree: on root, alternate and blocked ports peer
+    // would take them as new information and propose again.
     for(auto &port : m_ports) {
         BridgePort *bridgePort = static_cast<BridgePort*>(port.second);
-        if (bridgePort->getType() == BridgePort::Type::CLIENT) continue;
+        if (bridgePort->getType() == BridgePort::Type::CLIENT ||
+            bridgePort == senderPort || bridgePort->getVersion() < 2 ||
+            !isDesignated(bridgePort))
+            continue;
+        hello.portID = bridgePort->getID();
+        send(bridgePort, 2, hello);
+    }
+}
 
-        if (bridgePort->getRootID() != m_rootID)
-            bridgePort->markOpened();
+void Bridge::disconnected(BridgePort *senderPort)
+{
+    BridgeMonitor m(m_monitor);
+    m_forwarding.remove(senderPort);
+    if (senderPort->getType() == BridgePort::Type::CLIENT) return;
+
+    // Lost root port fails over to alternate port at once, ranking of
+    // alternates is updated for any other port
+    if (senderPort == m_rootPort)
+        failover();
+    else
+        updateRoot();
+
+    // Port does not hold linking any more
+    checkLinked();
+}
+
+void Bridge::upgraded(BridgePort *senderPort)
+{
+    BridgeMonitor m(m_monitor);
+
+    // Messages sent before peer's version was known carried no ids, so
+    // ties are decided again
+    if (senderPort != m_rootPort) offer(senderPort);
+}
+
+void Bridge::infoExpired(BridgePort *senderPort)
+{
+    BridgeMonitor m(m_monitor);
+
+    senderPort->resetInfo();
+    senderPort->updatePortLabel();
+
+    // Peer on root port stopped sending hellos
+    if (senderPort == m_rootPort) {
+        senderPort->portMsg("Max age expired");
+        failover();
+    } else {
+        updateRoot();
+        offer(senderPort);
     }
+    checkLinked();
+}
+
+void Bridge::timeout()
+{
+    BridgeMonitor m(m_monitor);
 
-    // Open one root port
+    // Open all non-root, not active ports
     for(auto &port : m_ports) {
         BridgePort *bridgePort = static_cast<BridgePort*>(port.second);
         if (bridgePort->getType() == BridgePort::Type::CLIENT) continue;
 
-        if (bridgePort->getRootID() == m_rootID &&
-            bridgePort->getRootPath() == m_rootPath &&
-            m_rootID != m_id) {
+        if (bridgePort->getRootID() != m_root.rootID)
             bridgePort->markOpened();
+    }
 
-            // Send open port request message
-            string msg = "B";
-            msg += (char)(1);
-            msg.append(8,(char)0);
-            bridgePort->sendMessage(msg, true);
-
-            break;
-        }
+    // Open root port, peer of version 1 opens its side on request
+    if (m_rootPort) {
+        m_rootPort->markOpened();
+        send(m_rootPort, 1, PriorityVector());
     }
 
     m_state = State::WORKING;
     updateTitle();
+    scheduleHello();
 }
@@ -1,10 +1,28 @@
 #ifndef BRIDGE_H
 #define BRIDGE_H
 #include "Node.h"
+#include "ForwardingTable.h"
 #include <pthread.h>
+#include <climits>
 
 class BridgePort;
 
+// Root information of a port, compared in order: root id, path to root,
+// id of bridge which sent it and id of its port. Lower is better. Bridges
+// of version 1 do not send ids, their information equals any other with
+// the same root and path.
+struct PriorityVector {
+    static const unsigned UNKNOWN = UINT_MAX;
+
+    unsigned rootID;
+    unsigned rootPath;
+    unsigned bridgeID;
+    unsigned portID;
+
+    bool operator<(const PriorityVector &other) const;
+    bool operator==(const PriorityVector &other) const;
+};
+
 class BridgeMonitor
 {
 public:
@@ -22,9 +40,10 @@ private:
 class Bridge : public Node
 {
 public:
-    Bridge(unsigned id, Display &display);
+    Bridge(unsigned id, Display &display, EventLoop &loop);
     ~Bridge();
     void handleCommand(const std::string &command);
+    bool removePort(Port *port);
 
     void updateTitle();
 
@@ -36,26 +55,83 @@ public:
     State getState();
 
     // Protocol specific
-    void initialize();
-    void sendToOtherPorts(Port *senderPort, const std::string &msg, 
+    void sendToOtherPorts(Port *senderPort, const char *msg, size_t size,
                           bool force, bool clientPorts);
-    void rootMsg(Port *senderPort, unsigned rootID, unsigned rootPath);
+    void sendToOtherPorts(Port *senderPort, const std::string &msg, 
+                          bool force, bool clientPorts) {
+        sendToOtherPorts(senderPort, msg.data(), msg.size(), force,
+                         clientPorts);
+    }
+    // Client frame goes to port where destination was seen, unknown
+    // destinations are flooded
+    void forward(BridgePort *senderPort, const char *msg, size_t size);
+
+    // Root information received by bridge port, proposal asks this bridge
+    // to agree when it comes on root port
+    void infoMsg(BridgePort *senderPort, const PriorityVector &info,
+                 bool proposal);
+    void agreementMsg(BridgePort *senderPort, const PriorityVector &info);
+    void helloMsg(BridgePort *senderPort, const PriorityVector &info);
+    void connected(BridgePort *senderPort);
     void disconnected(BridgePort *senderPort);
+    void upgraded(BridgePort *senderPort);
+    void infoExpired(BridgePort *senderPort);
     void setTimeout();
     void timeout();
 
+    // Protocol timers in milliseconds
+    unsigned getMaxAge() const {
+        return m_maxAge;
+    }
+
 private:
-    
-    // Bridge thread (for timeouts)
-    static void* threadStart(void *bridge);
-    void start();
 
-    unsigned m_rootID;
-    unsigned m_rootPath;
+    // Proposal/agreement on links to bridges of version 2: designated
+    // port proposes root information, downstream bridge closes its other
+    // ports, opens root port and agrees. Designated port is opened as soon
+    // as agreement comes, timeout is needed only for version 1 peers.
+    //
+    // Port is designated when information offered on it is better than
+    // information heard from peer, so each link has one designated port.
+    PriorityVector getOffer(BridgePort *port) const;
+    bool isDesignated(BridgePort *port) const;
+    void send(BridgePort *port, char type, const PriorityVector &info);
+    void offer(BridgePort *port);
+    void agree();
+    void agreeBlocked(BridgePort *port, const PriorityVector &info);
+    void block(BridgePort *port);
+
+    // Topology changes are handled on ports they concern. Root port is
+    // chosen from root and alternate ports, bridge is linking while some
+    // port waits for agreement or forward delay.
+    //
+    // Alternate port is the best port after root port. It has heard root
+    // through other bridge, so it replaces lost root port without closing
+    // downstream ports or waiting for forward delay.
+    void updateRoot(BridgePort *alternate = nullptr);
+    void failover();
+    void startLinking();
+    void checkLinked();
+
+    void scheduleHello();
+    void sendHello(BridgePort *senderPort, const PriorityVector &info);
+
+    // Information heard on root port, bridge's own when it is root
+    PriorityVector m_root;
+    BridgePort *m_rootPort;
+    BridgePort *m_alternatePort;
     State m_state;
 
-    pthread_t m_thread;
-    bool m_kill;
+    // Root sends hello every hello time, other bridges pass it from root
+    // port to other ports. Port information not refreshed for max age is
+    // dropped. Ports are opened after forward delay.
+    unsigned m_helloTime;
+    unsigned m_maxAge;
+    unsigned m_forwardDelay;
+    EventLoop::TimerID m_helloTimer;
+    ForwardingTable m_forwarding;
+
+    EventLoop::TimerID m_timer;
     pthread_mutexattr_t m_monitorAttr;
     pthread_mutex_t m_monitor;
 };
@@ -2,95 +2,101 @@
 #include "Bridge.h"
 using namespace std;
 
-void BridgePort::gotMsg(const std::string &msg)
+static string describe(const PriorityVector &info)
 {
-    // Extract bridge message
-    unsigned int msgSize = 10;
-    bool finished = false;
-    m_buffer += msg;
+    string str = "root=";
+    str += to_string(info.rootID);
+    str += ", path=";
+    str += to_string(info.rootPath);
+    if (info.bridgeID != PriorityVector::UNKNOWN) {
+        str += ", bridge=";
+        str += to_string(info.bridgeID);
+        str += ", port=";
+        str += to_string(info.portID);
+    }
+    return str;
+}
+
+BridgePort::~BridgePort()
+{
+    m_loop.cancelTimer(m_ageTimer);
+}
+
+void BridgePort::gotMsg(const char *msg, size_t size)
+{
+    // Raw data is not logged by headless display
+    if (m_node.getDisplay().isHeadless()) return;
 
     // Display raw message
     MsgInfo info;
-    info.msg = msg;
+    info.msg.assign(msg, size);
     info.header = "RAW:";
     m_displayInfo.addMsg(info); 
     m_node.getDisplay().queueUpdate();
+}
 
-    // Get bridge msg
-    while(!finished) {
-        finished = true;
-        for (int i = 0; i < m_buffer.size(); ++i) {
-            if (m_buffer[i] == 'B' && i+msgSize-1 < m_buffer.size()) {
-                bridgeMessageReceived(m_buffer.substr(i, msgSize));
-                finished = false;
-                m_buffer = m_buffer.substr(i+msgSize);
-                break;
-            }
-
-            if (m_buffer[i] == 'C' && i+msgSize-1 < m_buffer.size()) {
-                clientMessageReceived(m_buffer.substr(i, msgSize));
-                finished = false;
-                m_buffer = m_buffer.substr(i+msgSize);
-                break;
-            }
-        }
-    }
+void BridgePort::gotFrame(const Frame &frame)
+{
+    // Frames of version 2 carry their length, ignore short ones
+    if (frame.size < 10) return;
+
+    if (frame.data[0] == 'B')
+        bridgeMessageReceived(frame);
+    else
+        clientMessageReceived(frame);
 }
 
-void BridgePort::bridgeMessageReceived(const std::string &msg)
+void BridgePort::bridgeMessageReceived(const Frame &msg)
 {
     // Ignore if client port
     if (m_type == Type::CLIENT) return;
 
     // Get root id and root path
-    uint32_t rootID = 
-        ntohl(*reinterpret_cast<const uint32_t*>(msg.c_str() + 2));
-    uint32_t rootPath = 
-        ntohl(*reinterpret_cast<const uint32_t*>(msg.c_str() + 6));
-
-    // Display message
-    MsgInfo info;
+    PriorityVector info;
+    info.rootID = 
+        ntohl(*reinterpret_cast<const uint32_t*>(msg.data + 2));
+    info.rootPath = 
+        ntohl(*reinterpret_cast<const uint32_t*>(msg.data + 6));
+
+    // Bridges of version 1 do not send their ids
+    info.bridgeID = PriorityVector::UNKNOWN;
+    info.portID = PriorityVector::UNKNOWN;
+    if (msg.size >= 18) {
+        info.bridgeID =
+            ntohl(*reinterpret_cast<const uint32_t*>(msg.data + 10));
+        info.portID =
+            ntohl(*reinterpret_cast<const uint32_t*>(msg.data + 14));
+    }
 
     // Got message to open port
-    if (msg[1] == (char)1) {
+    if (msg.data[1] == (char)1) {
         markOpened();
-        info.header = "Open port";
-        m_displayInfo.addMsg(info); 
-        m_node.getDisplay().queueUpdate();
+        addMsg("Open port");
         return;
-    } else {
-        info.header = "Root msg: root=";
-        info.header += to_string(rootID);
-        info.header += ", path=";
-        info.header += to_string(rootPath);
-        m_displayInfo.addMsg(info); 
-        m_node.getDisplay().queueUpdate();
     }
 
-    // Depending on state behaviour is different
-    if (m_bridge.getState() == Bridge::State::WORKING) {
-        info.header = "Initialize!";
-        m_displayInfo.addMsg(info); 
-        m_node.getDisplay().queueUpdate();
-
-        // New bridge in network
-        m_bridge.initialize();
-        // Handle message
-        bridgeRootMsg(rootID, rootPath);         
+    // Periodic hello is not logged
+    if (msg.data[1] == (char)2) {
+        m_bridge.helloMsg(this, info);
+        return;
     }
 
-    if (m_bridge.getState() == Bridge::State::LINKING) {
-        // Handle message
-        bridgeRootMsg(rootID, rootPath); 
+    if (msg.data[1] == (char)4) {
+        addMsg("Agreement: " + describe(info));
+        m_bridge.agreementMsg(this, info);
+        return;
     }
+
+    bool proposal = msg.data[1] == (char)3;
+    addMsg((proposal ? "Proposal: " : "Root msg: ") + describe(info));
+    m_bridge.infoMsg(this, info, proposal);
 }
 
-void BridgePort::clientMessageReceived(const std::string &msg)
+void BridgePort::clientMessageReceived(const Frame &msg)
 {
-    // Resend only if port is not blocked and in working state
-    if (m_displayInfo.getStatus() == ConnectionInfo::Status::OPENED &&
-        m_bridge.getState() == Bridge::State::WORKING)
-        m_bridge.sendToOtherPorts(this, msg, false, true);
+    // Resend only if port is not blocked, other ports may still link
+    if (m_displayInfo.getStatus() == ConnectionInfo::Status::OPENED)
+        m_bridge.forward(this, msg.data, msg.size);
 }
 
 void BridgePort::connected()
@@ -100,32 +106,66 @@ void BridgePort::connected()
         return;
     }
 
-    // Display message
-    MsgInfo info;
-    info.header = "Initialize!";
-    m_displayInfo.addMsg(info); 
-    m_node.getDisplay().queueUpdate();
-
-    m_bridge.initialize();
+    addMsg("New neighbour");
+    m_bridge.connected(this);
 }
 
 void BridgePort::disconnected()
 {
-    if (m_type == Type::CLIENT) return;
+    // Next peer starts with nothing heard
+    if (m_type == Type::BRIDGE) {
+        resetInfo();
+        updatePortLabel();
+    }
     m_bridge.disconnected(this);
 }
 
-void BridgePort::bridgeRootMsg(unsigned rootID, unsigned rootPath)
+void BridgePort::upgraded()
 {
-    if (rootID < m_rootID || (rootID == m_rootID && rootPath < m_rootPath))
-    {
-        m_rootPath = rootPath;
-        m_rootID = rootID;
+    if (m_type == Type::BRIDGE) m_bridge.upgraded(this);
+}
 
-        updatePortLabel();
+Port* BridgePort::createPeer(unsigned id)
+{
+    return new BridgePort(m_node, id, Port::ConnectionType::SERVER, m_type);
+}
 
-        m_bridge.rootMsg(this, m_rootID, m_rootPath);
-    }
+void BridgePort::refreshInfo(const PriorityVector &info)
+{
+    bool changed = info.rootID != m_info.rootID ||
+                   info.rootPath != m_info.rootPath;
+    m_info = info;
+    if (changed) updatePortLabel();
+
+    // Bridges of version 1 send no hellos
+    m_loop.cancelTimer(m_ageTimer);
+    m_ageTimer = 0;
+    if (getVersion() < 2) return;
+
+    m_ageTimer = m_loop.setTimer(m_bridge.getMaxAge(), [this]() {
+        m_ageTimer = 0;
+        m_bridge.infoExpired(this);
+    });
+}
+
+void BridgePort::resetInfo()
+{
+    m_info.rootID = m_node.getID();
+    m_info.rootPath = 0;
+    m_info.bridgeID = m_node.getID();
+    m_info.portID = m_id;
+
+    // Nothing to expire
+    m_loop.cancelTimer(m_ageTimer);
+    m_ageTimer = 0;
+}
+
+void BridgePort::addMsg(const string &header)
+{
+    MsgInfo info;
+    info.header = header;
+    m_displayInfo.addMsg(info);
+    m_node.getDisplay().queueUpdate();
 }
 
 void BridgePort::updatePortLabel()
@@ -135,9 +175,9 @@ void BridgePort::updatePortLabel()
         m_node.getDisplay().queueUpdate();
     } else {
         string str = "root=";
-        str += to_string(m_rootID);
+        str += to_string(m_info.rootID);
         str += ", path=";
-        str += to_string(m_rootPath);
+        str += to_string(m_info.rootPath);
 
         m_displayInfo.setClientID(str);
         m_node.getDisplay().queueUpdate();
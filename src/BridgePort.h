@@ -14,29 +14,36 @@ public:
 
     BridgePort(Node &node, unsigned id, Port::ConnectionType connType,
                Type type)
-        : Port(node, id, connType), m_bridge(static_cast<Bridge&>(node)),
-          m_rootID(0), m_rootPath(0), m_type(type) {}
+        : Port(node, id, connType, "BC"), m_bridge(static_cast<Bridge&>(node)),
+          m_ageTimer(0), m_type(type) {
+        resetInfo();
+    }
+    ~BridgePort();
     
-    void gotMsg(const std::string &msg);
-    void bridgeMessageReceived(const std::string &msg);
-    void clientMessageReceived(const std::string &msg);
-    void bridgeRootMsg(unsigned rootID, unsigned rootPath);
+    void gotMsg(const char *msg, size_t size);
+    void gotFrame(const Frame &frame);
+    void bridgeMessageReceived(const Frame &msg);
+    void clientMessageReceived(const Frame &msg);
+
+    // Store root information heard from peer, it expires after max age
+    void refreshInfo(const PriorityVector &info);
+
+    // Nothing heard from peer, port keeps bridge's own id
+    void resetInfo();
 
     void connected();
     void disconnected();
+    void upgraded();
+    Port* createPeer(unsigned id);
 
-    void setRootID(unsigned rootID) {
-        m_rootID = rootID;
+    const PriorityVector& getInfo() const {
+        return m_info;
     }
     unsigned getRootID() const {
-        return m_rootID;
-    }
-
-    void setRootPath(unsigned rootPath) {
-        m_rootPath = rootPath;
+        return m_info.rootID;
     }
     unsigned getRootPath() const {
-        return m_rootPath;
+        return m_info.rootPath;
     }
 
     Type getType() const {
@@ -45,13 +52,15 @@ public:
 
     void updatePortLabel();
 
+    // Show protocol event in port's message list
+    void addMsg(const std::string &header);
+
 private:
 
-    std::string m_buffer;
     Bridge &m_bridge;
 
-    unsigned m_rootID;
-    unsigned m_rootPath;
+    PriorityVector m_info;
+    EventLoop::TimerID m_ageTimer;
 
     Type m_type;
 };
@@ -1,10 +1,23 @@
 #include "Client.h"
 #include "ClientPort.h"
 #include <boost/regex.hpp>
+#include <algorithm>
+#include <cstring>
 using namespace std;
 
-Client::Client(unsigned id, Display &display) : Node(id, display), 
-               m_port(nullptr)
+// Default size of whole fragment on the wire
+static const size_t DEFAULT_MTU = 1400;
+static const size_t MIN_MTU = 64;
+
+static void appendNumber(string &out, uint32_t value)
+{
+    value = htonl(value);
+    out.append(reinterpret_cast<char*>(&value), 4);
+}
+
+Client::Client(unsigned id, Display &display, EventLoop &loop)
+               : Node(id, display, loop), m_port(nullptr), m_nextMsgID(0),
+                 m_mtu(DEFAULT_MTU), m_pumping(false)
 {
     string title = " CLIENT (";
     title += to_string(id);
@@ -21,10 +34,70 @@ bool Client::addPort(Port *port) {
 
 bool Client::removePort(Port *port) {
     bool res = Node::removePort(port);
-    if (res) m_port = nullptr;
+    if (res) {
+        m_port = nullptr;
+        m_outgoing.clear();
+    }
     return res;
 }
 
+void Client::queueMessage(uint32_t dest,
+                          const shared_ptr<const string> &payload)
+{
+    if (payload->size() > MESSAGE_MAX_SIZE) {
+        m_display.setError("Message is too long");
+        return;
+    }
+
+    // Old peers drop frames longer than version 1 frame
+    if (m_port->isConnected() && m_port->getVersion() < 2)
+        m_display.setError("Message waits for peer with protocol v2");
+
+    Outgoing msg;
+    msg.dest = dest;
+    msg.id = m_nextMsgID++;
+    msg.payload = payload;
+    msg.offset = 0;
+    m_outgoing.push_back(msg);
+    pump();
+}
+
+void Client::pump()
+{
+    // Sending can report drained port again
+    if (!m_port || m_pumping) return;
+    m_pumping = true;
+
+    size_t space = m_mtu - FRAME_HEADER_SIZE - FRAGMENT_HEADER_SIZE;
+    while (!m_outgoing.empty() && m_port->isConnected() &&
+           m_port->getVersion() >= 2 && !m_port->isCongested()) {
+        Outgoing &msg = m_outgoing.front();
+        const string &payload = *msg.payload;
+        size_t size = min(space, payload.size() - msg.offset);
+
+        m_frame.assign(1, 'D');
+        appendNumber(m_frame, m_id);
+        appendNumber(m_frame, msg.dest);
+        appendNumber(m_frame, msg.id);
+        appendNumber(m_frame, msg.offset);
+        appendNumber(m_frame, payload.size());
+        m_frame.append(payload, msg.offset, size);
+
+        // Fragment is sent again when port is drained or reconnected
+        if (!m_port->sendMessage(m_frame, false)) break;
+
+        msg.offset += size;
+        if (msg.offset == payload.size()) m_outgoing.pop_front();
+    }
+
+    m_pumping = false;
+}
+
+void Client::rewind()
+{
+    if (!m_outgoing.empty()) m_outgoing.front().offset = 0;
+}
+
 void Client::handleCommand(const string &command)
 {
     // Regular expression structure
@@ -34,12 +107,14 @@ void Client::handleCommand(const string &command)
     // Port creation
     if (command.substr(0,4).compare("port") == 0) {
         auto port = new ClientPort(*this, 0, Port::ConnectionType::SERVER);
-        r.assign("port ([0-9]+)");
+        r.assign("port ?([0-9]+)?( (tcp|udp|shm))?");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched) {
             unsigned portNr = stoul(cm[1]);
             port->setPort(portNr);
         }
+        if (cm[3].matched)
+            port->setTransport(cm[3]);
         addPort(port);
         return;
     }
@@ -63,7 +138,7 @@ void Client::handleCommand(const string &command)
 
     // Connect to port
     if (command.substr(0,4).compare("conn") == 0) {
-        r.assign("conn ([0-9.]+):([0-9]+) ?([0-9]+)?");
+        r.assign("conn ([0-9.]+):([0-9]+) ?([0-9]+)?( (tcp|udp|shm))?");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched && cm[2].matched) {
             unsigned portNr = stoul(cm[2]);
@@ -74,6 +149,8 @@ void Client::handleCommand(const string &command)
                 portNr = stoul(cm[3]);
                 port->setPort(portNr);
             }
+            if (cm[5].matched)
+                port->setTransport(cm[5]);
             addPort(port);
         }
         return;
@@ -81,18 +158,63 @@ void Client::handleCommand(const string &command)
 
     //Send message
     if (command.substr(0,4).compare("send") == 0 && m_port) {
-        r.assign("send ([0-9]+) ([[:alpha:]])");
+        r.assign("send ([0-9]+) (.+)");
         regex_match(command.c_str(), cm, r);
         if (cm[1].matched && cm[2].matched) {
-            string msg = "C";
-            uint32_t source = m_id;
             uint32_t dest = stoul(cm[1]);
-            source = htonl(source);
-            dest = htonl(dest);
-            msg.append(reinterpret_cast<char*>(&source), 4);
-            msg.append(reinterpret_cast<char*>(&dest), 4);
-            msg.append(cm[2]);
-            m_port->sendMessage(msg, true);
+            string text = cm[2];
+
+            // Single letter is understood by every client
+            if (text.size() == 1 && isalpha(text[0])) {
+                string msg = "C";
+                appendNumber(msg, m_id);
+                appendNumber(msg, dest);
+                msg.append(text);
+                m_port->sendMessage(msg, true);
+                return;
+            }
+
+            queueMessage(dest, make_shared<const string>(text));
+        }
+        return;
+    }
+
+    // Send messages of given size
+    if (command.substr(0,5).compare("bench") == 0 && m_port) {
+        r.assign("bench ([0-9]+) ([0-9]+)( ([0-9]+))?");
+        regex_match(command.c_str(), cm, r);
+        if (cm[1].matched && cm[2].matched) {
+            uint32_t dest = stoul(cm[1]);
+            size_t size = stoul(cm[2]);
+            unsigned count = cm[4].matched ? stoul(cm[4]) : 1;
+            if (!size || size > MESSAGE_MAX_SIZE) {
+                m_display.setError("Wrong message size");
+                return;
+            }
+
+            // Messages share payload
+            string data(size, 0);
+            for (size_t i = 0; i < size; ++i) data[i] = i * 31 + 7;
+            auto payload = make_shared<const string>(move(data));
+            for (unsigned i = 0; i < count; ++i) queueMessage(dest, payload);
+        }
+        return;
+    }
+
+    // Fragment size
+    if (command.substr(0,3).compare("mtu") == 0) {
+        r.assign("mtu ([0-9]+)");
+        regex_match(command.c_str(), cm, r);
+        if (cm[1].matched) {
+            size_t mtu = stoul(cm[1]);
+            if (mtu < MIN_MTU || mtu > FRAME_HEADER_SIZE + FRAME_MAX_SIZE) {
+                m_display.setError("MTU must be between " +
+                                   to_string(MIN_MTU) + " and " +
+                                   to_string(FRAME_HEADER_SIZE +
+                                             FRAME_MAX_SIZE));
+                return;
+            }
+            m_mtu = mtu;
         }
         return;
     }
@@ -1,20 +1,46 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 #include "Node.h"
+#include <deque>
+#include <memory>
 
 class ClientPort;
 
 class Client : public Node
 {
 public:
-    Client(unsigned id, Display &display);
+    Client(unsigned id, Display &display, EventLoop &loop);
     void handleCommand(const std::string &command);
     bool addPort(Port *port);
     bool removePort(Port *port);
 
+    // Send queued fragments until port becomes congested
+    void pump();
+
+    // Peer drops partly received message on disconnect, so front message
+    // is sent again from its beginning
+    void rewind();
+
 private:
 
+    // Message split into fragments of at most m_mtu bytes (with frame
+    // header). Benchmark messages share payload.
+    struct Outgoing {
+        uint32_t dest;
+        uint32_t id;
+        std::shared_ptr<const std::string> payload;
+        size_t offset;
+    };
+
+    void queueMessage(uint32_t dest,
+                      const std::shared_ptr<const std::string> &payload);
+
     ClientPort *m_port;
+    std::deque<Outgoing> m_outgoing;
+    uint32_t m_nextMsgID;
+    size_t m_mtu;
+    std::string m_frame;
+    bool m_pumping;
 };
 
 #endif //CLIENT_H
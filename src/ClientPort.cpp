@@ -1,41 +1,74 @@
 #include "ClientPort.h"
 #include "Client.h"
+#include <cstring>
+#include <ctime>
+using namespace std;
 
-void ClientPort::gotMsg(const std::string &msg)
+// Incomplete messages kept at once, oldest one is dropped
+static const size_t MAX_PARTIAL = 16;
+
+static unsigned long now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static uint32_t readNumber(const char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, 4);
+    return ntohl(value);
+}
+
+// Merge range into filled ranges, returns number of bytes not filled before
+static size_t fill(map<size_t, size_t> &filled, size_t begin, size_t end)
+{
+    // Start with range which may overlap or touch the new one
+    auto it = filled.upper_bound(begin);
+    if (it != filled.begin() && prev(it)->second >= begin) --it;
+
+    size_t added = end - begin;
+    size_t first = begin;
+    size_t last = end;
+    while (it != filled.end() && it->first <= end) {
+        added -= min(it->second, end) - max(it->first, begin);
+        first = min(first, it->first);
+        last = max(last, it->second);
+        it = filled.erase(it);
+    }
+    filled[first] = last;
+    return added;
+}
+
+void ClientPort::gotMsg(const char *msg, size_t size)
 {
-    // Extract client message
-    unsigned int msgSize = 10;
-    bool finished = false;
-    m_buffer += msg;
+    // Raw data is not logged by headless display
+    if (m_node.getDisplay().isHeadless()) return;
 
     // Display raw message
     MsgInfo info;
-    info.msg = msg;
+    info.msg.assign(msg, size);
     info.header = "RAW:";
     m_displayInfo.addMsg(info); 
     m_node.getDisplay().queueUpdate();
-
-    // Get client msg
-    while(!finished) {
-        finished = true;
-        for (int i = 0; i < m_buffer.size(); ++i) {
-            if (m_buffer[i] == 'C' && i+msgSize-1 < m_buffer.size()) {
-                messageReceived(m_buffer.substr(i, msgSize));
-                finished = false;
-                m_buffer = m_buffer.substr(i+msgSize);
-                break;
-            }
-        }
-    }
 }
 
-void ClientPort::messageReceived(const std::string &msg)
+void ClientPort::gotFrame(const Frame &frame)
 {
+    // Frames of version 2 carry their length, ignore short ones
+    if (frame.size < 10) return;
+
+    if (*frame.data == 'D') {
+        gotFragment(frame);
+        return;
+    }
+
     uint32_t source;
     uint32_t dest;
-    source = ntohl(*reinterpret_cast<const uint32_t*>(msg.c_str()+1));
-    dest = ntohl(*reinterpret_cast<const uint32_t*>(msg.c_str()+5));
-    char letter = msg.c_str()[9];
+    source = ntohl(*reinterpret_cast<const uint32_t*>(frame.data+1));
+    dest = ntohl(*reinterpret_cast<const uint32_t*>(frame.data+5));
+    char letter = frame.data[9];
 
     // Check if message is for us
     if (dest == m_node.getID()) {
@@ -44,13 +77,116 @@ void ClientPort::messageReceived(const std::string &msg)
         info.header = "Got: '";
         info.header += letter;
         info.header += "' from: ";
-        info.header += std::to_string(source);
+        info.header += to_string(source);
         m_displayInfo.addMsg(info); 
         m_node.getDisplay().queueUpdate();
     }
 }
 
+void ClientPort::gotFragment(const Frame &frame)
+{
+    if (frame.size <= FRAGMENT_HEADER_SIZE) return;
+    uint32_t source = readNumber(frame.data + 1);
+    uint32_t dest = readNumber(frame.data + 5);
+    uint32_t id = readNumber(frame.data + 9);
+    size_t offset = readNumber(frame.data + 13);
+    size_t total = readNumber(frame.data + 17);
+    size_t size = frame.size - FRAGMENT_HEADER_SIZE;
+    const char *data = frame.data + FRAGMENT_HEADER_SIZE;
+
+    // Bridges flood unknown destinations
+    if (dest != m_node.getID()) return;
+    if (total > MESSAGE_MAX_SIZE || offset > total || size > total - offset)
+        return;
+
+    // Message in one fragment needs no copy
+    unsigned long time = now();
+    if (size == total) {
+        gotMessage(source, string(data, size), 0);
+        return;
+    }
+
+    uint64_t key = static_cast<uint64_t>(source) << 32 | id;
+    auto it = m_partial.find(key);
+    if (it == m_partial.end()) {
+        // Lost fragments leave incomplete messages, drop oldest one
+        if (m_partial.size() >= MAX_PARTIAL) {
+            auto oldest = m_partial.begin();
+            for (auto i = m_partial.begin(); i != m_partial.end(); ++i)
+                if (i->second.start < oldest->second.start) oldest = i;
+            MsgInfo info;
+            info.header = "Incomplete message from: ";
+            info.header += to_string(oldest->first >> 32);
+            m_displayInfo.addMsg(info);
+            m_partial.erase(oldest);
+        }
+
+        Reassembly &msg = m_partial[key];
+        msg.data.resize(total);
+        msg.received = 0;
+        msg.start = time;
+        it = m_partial.find(key);
+    }
+
+    // Duplicated fragments (flooding, datagrams) add nothing
+    Reassembly &msg = it->second;
+    if (msg.data.size() != total) return;
+    size_t added = fill(msg.filled, offset, offset + size);
+    if (!added) return;
+    memcpy(&msg.data[offset], data, size);
+    msg.received += added;
+    if (msg.received < total) return;
+
+    unsigned long start = msg.start;
+    string message;
+    message.swap(msg.data);
+    m_partial.erase(it);
+    gotMessage(source, message, time - start);
+}
+
+void ClientPort::gotMessage(uint32_t source, const string &data,
+                            unsigned long time)
+{
+    MsgInfo info;
+    bool text = data.size() <= 32;
+    for(char c : data)
+        text = text && isprint(static_cast<unsigned char>(c));
+
+    // Short text is shown, otherwise size and transfer rate
+    if (text) {
+        info.header = "Got: '" + data + "' from: " + to_string(source);
+    } else {
+        info.header = "Got: " + to_string(data.size()) + " bytes from: ";
+        info.header += to_string(source);
+        if (time) {
+            char rate[32];
+            snprintf(rate, sizeof(rate), " (%.1f MB/s)",
+                     data.size() / 1000.0 / time);
+            info.header += rate;
+        }
+    }
+    m_displayInfo.addMsg(info);
+    m_node.getDisplay().queueUpdate();
+}
+
 void ClientPort::connected()
 {
     markOpened();
+    static_cast<Client&>(m_node).pump();
+}
+
+void ClientPort::disconnected()
+{
+    m_partial.clear();
+    static_cast<Client&>(m_node).rewind();
+}
+
+void ClientPort::drained()
+{
+    static_cast<Client&>(m_node).pump();
+}
+
+void ClientPort::upgraded()
+{
+    static_cast<Client&>(m_node).pump();
 }
@@ -1,20 +1,44 @@
 #ifndef CLIENT_PORT_H
 #define CLIENT_PORT_H
 #include "Port.h"
+#include <map>
+#include <unordered_map>
+
+// Data frame carries fragment of a message:
+//   'D' | source | destination | message id | offset | size | data
+// Numbers have 4 bytes and are big endian, size is size of whole message.
+static const size_t FRAGMENT_HEADER_SIZE = 21;
+static const size_t MESSAGE_MAX_SIZE = 64 * 1024 * 1024;
 
 class ClientPort : public Port
 {
 public:
     ClientPort(Node &node, unsigned id, Port::ConnectionType connType)
-        : Port(node, id, connType) {}
+        : Port(node, id, connType, "C") {}
     
-    void gotMsg(const std::string &msg);
-    void messageReceived(const std::string &msg);
+    void gotMsg(const char *msg, size_t size);
+    void gotFrame(const Frame &frame);
 
     void connected();
+    void disconnected();
+    void drained();
+    void upgraded();
 
 private:
-    std::string m_buffer;
+
+    void gotFragment(const Frame &frame);
+    void gotMessage(uint32_t source, const std::string &data,
+                    unsigned long time);
+
+    // Messages being reassembled by source and message id. Filled ranges
+    // (start to end offset) tell apart duplicated fragments.
+    struct Reassembly {
+        std::string data;
+        std::map<size_t, size_t> filled;
+        size_t received;
+        unsigned long start;
+    };
+    std::unordered_map<uint64_t, Reassembly> m_partial;
 };
 
 #endif //CLIENT_PORT_H
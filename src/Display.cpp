@@ -1,9 +1,37 @@
 #include "Display.h"
 #include <ncurses.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 using namespace std;
 
-Display::Display()
+// Connection panel shows its header and at least one message
+static const int MIN_PANEL_HEIGHT = 2;
+
+static unsigned long now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+Display::Display(Mode mode)
+    : m_help(mode == Mode::TERMINAL), m_mode(mode),
+      m_visible(mode == Mode::TERMINAL), m_statusFD(-1), m_dirty(true),
+      m_frameInterval(50), m_lastFrame(0),
+      m_msgDepth(mode == Mode::HEADLESS ? 0 : 128),
+      m_msgLog(nullptr), m_viewDirty(true),
+      m_order(Order::ID), m_first(0), m_layoutDirty(true), m_panelHeight(0),
+      m_rows(0), m_cols(0), m_titleWin(nullptr), m_promptWin(nullptr),
+      m_helpWin(nullptr)
 {
+    m_drawingThread = pthread_self();
+    if (m_mode != Mode::TERMINAL) return;
+
     setlocale(LC_ALL, "");
     initscr();
 
@@ -20,20 +48,79 @@ Display::Display()
     raw();
 	keypad(stdscr, TRUE);
 	noecho();
-    m_help = true;
-
-    m_drawingThread = pthread_self();
 }
 
 Display::~Display()
 {
-    endwin();
+    destroyWindows();
+    if (m_msgLog) fclose(m_msgLog);
+    if (m_mode == Mode::TERMINAL) endwin();
+}
+
+void Display::setTitle(const std::string &title)
+{
+    m_drawMutex.lock();
+    m_title = title;
+    if (m_mode == Mode::HEADLESS) log("title", title);
+    if (m_statusFD != -1) {
+        string line(title);
+        line += '\n';
+        if (write(m_statusFD, line.data(), line.size()) == -1) {
+            // Nobody reads status fast enough, drop it
+        }
+    }
+    m_drawMutex.unlock();
+}
+
+void Display::setError(const std::string &error)
+{
+    m_drawMutex.lock();
+    if (m_error != error) invalidate();
+    m_error = error;
+    if (m_mode == Mode::HEADLESS && !error.empty()) log("error", error);
+    m_drawMutex.unlock();
+}
+
+void Display::log(const char *kind, const std::string &text)
+{
+    // One line per event: "<kind> <text>" without leading spaces
+    auto pos = text.find_first_not_of(' ');
+    if (pos == string::npos) pos = text.size();
+    printf("%s%s %s\n", m_logPrefix.c_str(), kind, text.c_str() + pos);
+    fflush(stdout);
+}
+
+bool Display::openMsgLog(const string &path)
+{
+    if (m_msgLog) fclose(m_msgLog);
+    m_msgLog = fopen(path.c_str(), "a");
+    return m_msgLog != nullptr;
+}
+
+void Display::logMsg(const ConnectionInfo *conn, const MsgInfo &msg)
+{
+    // Log is written only by event loop thread
+    if (!m_msgLog) return;
+
+    // Same format as on screen, prefixed with port number
+    fprintf(m_msgLog, "%s %s", conn->getPort().c_str(), msg.header.c_str());
+    for(char c : msg.msg)
+        fprintf(m_msgLog, " %.2X", static_cast<unsigned char>(c));
+    fputc('\n', m_msgLog);
+}
+
+void Display::setStatusFD(int fd)
+{
+    // Status is best effort, never block drawing or event loop
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    m_statusFD = fd;
 }
 
 void Display::addConnection(const ConnectionInfo *conn)
 {
     m_drawMutex.lock();
     m_conns.insert(conn);
+    m_viewDirty = true;
     m_drawMutex.unlock();
 }
 
@@ -43,175 +130,465 @@ void Display::rmConnection(const ConnectionInfo *conn)
     auto it = m_conns.find(conn);
     if (it != m_conns.end())
         m_conns.erase(it);
+    m_viewDirty = true;
     m_drawMutex.unlock();
 }
 
-void Display::queueUpdate()
+void Display::setFilter(const string &filter)
 {
     m_drawMutex.lock();
-    pthread_kill(m_drawingThread, SIGUSR1);
+    m_filter = filter;
+    m_first = 0;
+    m_viewDirty = true;
     m_drawMutex.unlock();
+    invalidate();
 }
 
-void Display::update()
+void Display::setOrder(Order order)
 {
     m_drawMutex.lock();
-    clear();
-
-    // Calculate available dimensions
-    unsigned y = getmaxy(stdscr);
-    if (y < 3) return;
-
-    attron(COLOR_PAIR(1));
-
-    // Calculate space for each connection
-    if (m_conns.size()) {
-        unsigned connY = (y-2) / m_conns.size();
-        unsigned currY = 1;
-        
-        // Draw each connection
-        for(auto &conn : m_conns) {
-            attron(A_BOLD);
-            mvprintw(currY, 0, "[");
-            switch(conn->getStatus()) {
-                case ConnectionInfo::Status::NOT_CONNECTED:
-                    attron(COLOR_PAIR(3));
-                    printw("-");
-                    break;
-                case ConnectionInfo::Status::OPENED:
-                    attron(COLOR_PAIR(2));
-                    printw("o");
-                    break;
-                case ConnectionInfo::Status::CLOSED:
-                    attron(COLOR_PAIR(4));
-                    printw("c");
-                    break;
-            };
-            attron(COLOR_PAIR(1));
-
-            printw("] (%s) %s:%s -> (%s) %s:%s",
-                    conn->getID().c_str(), conn->getAddress().c_str(), 
-                    conn->getPort().c_str(), conn->getClientID().c_str(),
-                    conn->getClientAddress().c_str(), 
-                    conn->getClientPort().c_str());
-            attroff(A_BOLD);
-
-            // Draw possible msgs
-            for (unsigned i = 0; i < conn->getMsgs().size() &&
-                                 i < connY - 1; ++i)
-            {
-                auto &msg = conn->getMsgs()[conn->getMsgs().size() - 1 - i];
-                mvprintw(currY + 1 + i, 0, " %s", msg.header.c_str());
-
-                for(char c : msg.msg)
-                    printw(" %.2X", c);
-            }
-                                     
-            currY += connY;
-        }
-    }
-
-    // Display help
-    if (m_help) {
+    m_order = order;
+    m_viewDirty = true;
+    m_drawMutex.unlock();
+    invalidate();
+}
 
-        m_helpLineOffset = 1;
-        drawHelpLine();
-        drawHelpLine(" * ","Startup commands:");
+void Display::scrollPanels(int panels)
+{
+    // Position is clamped by next update
+    m_drawMutex.lock();
+    if (panels < 0 && m_first < static_cast<size_t>(-panels))
+        m_first = 0;
+    else
+        m_first += panels;
+    m_drawMutex.unlock();
+    invalidate();
+}
 
-        drawHelpLine(" client <id>"," - create client node with specified id");
+void Display::scrollPages(int pages)
+{
+    int page = m_panels.empty() ? 1 : m_panels.size();
+    scrollPanels(pages * page);
+}
 
-        drawHelpLine(" bridge <id>"," - create bridge node with specified id");
-        drawHelpLine();
+bool Display::isShown(const ConnectionInfo *conn) const
+{
+    auto &state = conn->getShown();
+    if (m_filter.empty()) return true;
+    if (m_filter == "o")
+        return state.status == ConnectionInfo::Status::OPENED;
+    if (m_filter == "c")
+        return state.status == ConnectionInfo::Status::CLOSED;
+    if (m_filter == "-")
+        return state.status == ConnectionInfo::Status::NOT_CONNECTED;
+    return state.id == m_filter;
+}
 
-        drawHelpLine(" * ","Bridge commands:");
+void Display::buildView()
+{
+    m_viewDirty = false;
+    m_view.clear();
+    for(auto conn : m_conns) {
+        if (isShown(conn)) m_view.push_back(conn);
+    }
 
-        drawHelpLine(" bport <id> [port_nr]"," - create bridge port with");
-        drawHelpLine(""," specified id and start listening on it. You can");
-        drawHelpLine(""," optionally specify port number.");
+    // Ports are sorted by number, port id breaks ties
+    auto number = [](const string &s) { return strtoul(s.c_str(), 0, 10); };
+    Order order = m_order;
+    sort(m_view.begin(), m_view.end(),
+         [order, &number](const ConnectionInfo *c1, const ConnectionInfo *c2) {
+        auto &a = c1->getShown();
+        auto &b = c2->getShown();
+        if (order == Order::STATUS && a.status != b.status)
+            return a.status < b.status;
+        if (order == Order::PORT && a.port != b.port)
+            return number(a.port) < number(b.port);
+        if (a.id != b.id)
+            return number(a.id) < number(b.id);
+        return number(a.port) < number(b.port);
+    });
+}
 
-        drawHelpLine(" cport <id> [port_nr]"," - create client port with");
-        drawHelpLine(""," specified id and start listening on it. You can");
-        drawHelpLine(""," optionally specify port number.");
+void Display::queueUpdate()
+{
+    // Display already waits for redraw
+    if (!m_visible || m_dirty.exchange(true)) return;
+    pthread_kill(m_drawingThread, SIGUSR1);
+}
 
-        drawHelpLine(" bconn <id> <ip>:<port> [port_nr]"," - create bridge");
-        drawHelpLine(""," port with specified id and try to connect to");
-        drawHelpLine(""," ip:address. You can optionally specify port");
-        drawHelpLine(""," number.");
+int Display::getFrameDelay() const
+{
+    if (!m_dirty) return -1;
+    unsigned long elapsed = now() - m_lastFrame;
+    if (elapsed >= m_frameInterval) return 0;
+    return m_frameInterval - elapsed;
+}
 
-        drawHelpLine(" cconn <id> <ip>:<port> [port_nr]"," - create client");
-        drawHelpLine(""," port with specified id and try to connect to");
-        drawHelpLine(""," ip:address. You can optionally specify port");
-        drawHelpLine(""," number.");
+void Display::update()
+{
+    // Changes made while drawing will be drawn in next frame
+    m_dirty = false;
+    m_lastFrame = now();
 
-        drawHelpLine(" close <id> <seconds>"," - close port with specified");
-        drawHelpLine(""," id for 'seconds' seconds.");
+    m_drawMutex.lock();
 
-        drawHelpLine(" kill <id>"," - permanently close port with specified");
-        drawHelpLine(""," id");
-        drawHelpLine();
+    // Calculate available dimensions
+    int y = getmaxy(stdscr);
+    int x = getmaxx(stdscr);
+    if (y < 3) {
+        m_drawMutex.unlock();
+        return;
+    }
 
-        drawHelpLine(" * ", "Client commands:");
-        drawHelpLine(" port [port_nr]"," - open client port, you can ");
-        drawHelpLine(""," optionally specify port number");
+    if (m_viewDirty) buildView();
 
-        drawHelpLine(" conn <ip>:<port_nr> [port_nr]"," - create client port");
-        drawHelpLine(""," and connect it to <ip>:<port_nr> bridge/client.");
-        drawHelpLine(""," You can specify your port number.");
+    // Connections share screen evenly, but panels have minimal height.
+    // Only panels which fit on screen exist.
+    int area = y - 2;
+    size_t count = m_view.size();
+    int height = count ? area / count : area;
+    if (height < MIN_PANEL_HEIGHT) height = min(MIN_PANEL_HEIGHT, area);
+    size_t visible = min(count, static_cast<size_t>(area / height));
+    if (m_first + visible > count) m_first = count - visible;
 
-        drawHelpLine(" send <id> <letter>"," - send letter to another client");
-        drawHelpLine(""," with specified id.");
+    bool full = m_layoutDirty || y != m_rows || x != m_cols ||
+                visible != m_panels.size() || height != m_panelHeight;
+    if (full) layout(y, x, visible, height);
 
-        drawHelpLine(" close <seconds>", " - close current port for 'second'");
-        drawHelpLine(""," seconds.");
-        drawHelpLine(" kill", " - kill current port");
-        drawHelpLine();
-        drawHelpLine(" * ", "Other commands:");
-        drawHelpLine(" exit/quit/q", " - close program");
-        drawHelpLine();
-        drawHelpLine(" Type 'h' to see this message again...", "");
+    // Only changed panels are drawn, help covers all of them
+    if (m_help) {
+        if (full) drawHelp();
+    } else {
+        for (size_t i = 0; i < m_panels.size(); ++i) {
+            auto conn = m_view[m_first + i];
+            bool dirty = conn->m_dirty.exchange(false);
+            if (!full && !dirty && m_panelConns[i] == conn)
+                continue;
+            m_panelConns[i] = conn;
+            drawConnection(m_panels[i], conn);
+        }
     }
 
-    // Draw title and prompt
-    attron(A_BOLD);
-    attron(COLOR_PAIR(5));
-
-    clearLine(0);
-    mvprintw(0,0,"%s", m_title.c_str());
+    // Draw title and prompt, terminal gets only changed characters
+    wattron(m_titleWin, A_BOLD);
+    wattron(m_titleWin, COLOR_PAIR(5));
+    clearLine(m_titleWin, 0);
+    mvwprintw(m_titleWin, 0, 0, "%s", m_title.c_str());
+
+    // Position in connection list if some ports are not shown
+    if (visible < m_conns.size()) {
+        string position = "[";
+        if (visible) {
+            position += to_string(m_first + 1) + "-";
+            position += to_string(m_first + visible) + " of ";
+        }
+        position += to_string(count);
+        if (!m_filter.empty()) position += " '" + m_filter + "'";
+        position += "] ";
+        int pos = x - position.length();
+        if (pos < 0) pos = 0;
+        mvwprintw(m_titleWin, 0, pos, "%s", position.c_str());
+    }
+    wnoutrefresh(m_titleWin);
 
-    attron(COLOR_PAIR(5));
-    clearLine(y-1);
+    wattron(m_promptWin, A_BOLD);
+    wattron(m_promptWin, COLOR_PAIR(5));
+    clearLine(m_promptWin, 0);
 
     if (!m_error.empty()) {
-        attron(COLOR_PAIR(7));
-        int pos = getmaxx(stdscr) - m_error.length();
+        wattron(m_promptWin, COLOR_PAIR(7));
+        int pos = x - m_error.length();
         if (pos < 0) pos = 0;
-        mvprintw(y-1,pos,"%s", m_error.c_str());
+        mvwprintw(m_promptWin, 0, pos, "%s", m_error.c_str());
     }
 
-    attron(COLOR_PAIR(5));
-    mvprintw(y-1,0,"> %s", m_cmd.c_str());
-    attroff(A_BOLD);
-    refresh();
+    wattron(m_promptWin, COLOR_PAIR(5));
+    mvwprintw(m_promptWin, 0, 0, "> %s", m_cmd.c_str());
+    wnoutrefresh(m_promptWin);
+    doupdate();
 
     m_drawMutex.unlock();
 }
 
-void Display::clearLine(int y)
+void Display::layout(int rows, int cols, size_t panels, int height)
 {
-    move(y,0);
-    int x = getmaxx(stdscr);
-    for(int i = 0; i < x; ++i) addch(' ');
+    m_layoutDirty = false;
+    m_rows = rows;
+    m_cols = cols;
+    m_panelHeight = height;
+    destroyWindows();
+
+    // Rows not used by any panel stay empty
+    werase(stdscr);
+    wnoutrefresh(stdscr);
+
+    m_titleWin = newwin(1, cols, 0, 0);
+    m_promptWin = newwin(1, cols, rows - 1, 0);
+    m_helpWin = newwin(rows - 2, cols, 1, 0);
+
+    for (size_t i = 0; i < panels; ++i) {
+        m_panels.push_back(newwin(height, cols, 1 + i * height, 0));
+        m_panelConns.push_back(nullptr);
+    }
+}
+
+void Display::destroyWindows()
+{
+    for(auto win : m_panels)
+        delwin(win);
+    m_panels.clear();
+    m_panelConns.clear();
+
+    if (m_titleWin) delwin(m_titleWin);
+    if (m_promptWin) delwin(m_promptWin);
+    if (m_helpWin) delwin(m_helpWin);
+    m_titleWin = m_promptWin = m_helpWin = nullptr;
+}
+
+void Display::drawConnection(WINDOW *win, const ConnectionInfo *conn)
+{
+    auto &state = conn->getShown();
+    werase(win);
+    wattron(win, COLOR_PAIR(1));
+
+    wattron(win, A_BOLD);
+    mvwprintw(win, 0, 0, "[");
+    switch(state.status) {
+        case ConnectionInfo::Status::NOT_CONNECTED:
+            wattron(win, COLOR_PAIR(3));
+            wprintw(win, "-");
+            break;
+        case ConnectionInfo::Status::OPENED:
+            wattron(win, COLOR_PAIR(2));
+            wprintw(win, "o");
+            break;
+        case ConnectionInfo::Status::CLOSED:
+            wattron(win, COLOR_PAIR(4));
+            wprintw(win, "c");
+            break;
+    };
+    wattron(win, COLOR_PAIR(1));
+
+    wprintw(win, "] (%s) %s:%s -> (%s) %s:%s",
+            state.id.c_str(), state.address.c_str(), state.port.c_str(),
+            state.clientId.c_str(), state.clientAddress.c_str(),
+            state.clientPort.c_str());
+    wattroff(win, A_BOLD);
+
+    // Draw possible msgs, message overwritten while reading is skipped
+    // (panel is dirty again anyway)
+    unsigned height = getmaxy(win);
+    size_t count = conn->getMsgCount();
+    MsgInfo msg;
+    for (unsigned i = 0; i < count && i + 1 < height; ++i) {
+        if (!conn->getMsg(i, msg)) continue;
+        mvwprintw(win, 1 + i, 0, " %s", msg.header.c_str());
+
+        for(char c : msg.msg)
+            wprintw(win, " %.2X", static_cast<unsigned char>(c));
+    }
+
+    wnoutrefresh(win);
+}
+
+void Display::drawHelp()
+{
+    werase(m_helpWin);
+    m_helpLineOffset = 0;
+    drawHelpLine();
+    drawHelpLine(" * ","Startup commands:");
+
+    drawHelpLine(" client <id>"," - create client node with specified id");
+
+    drawHelpLine(" bridge <id>"," - create bridge node with specified id");
+    drawHelpLine();
+
+    drawHelpLine(" * ","Bridge commands:");
+
+    drawHelpLine(" bport <id> [port_nr] [tcp|udp|shm]",
+                 " - create bridge port with");
+    drawHelpLine(""," specified id and start listening on it. You can");
+    drawHelpLine(""," optionally specify port number and transport.");
+    drawHelpLine(""," Each additional peer gets its own port with id");
+    drawHelpLine(""," from 1000000 up.");
+
+    drawHelpLine(" cport <id> [port_nr] [tcp|udp|shm]",
+                 " - create client port with");
+    drawHelpLine(""," specified id and start listening on it. You can");
+    drawHelpLine(""," optionally specify port number and transport.");
+    drawHelpLine(""," Each additional peer gets its own port with id");
+    drawHelpLine(""," from 1000000 up.");
+
+    drawHelpLine(" bconn <id> <ip>:<port> [port_nr] [retry <n>]"
+                 " [tcp|udp|shm]", " - create bridge");
+    drawHelpLine(""," port with specified id and try to connect to");
+    drawHelpLine(""," ip:address. You can optionally specify port");
+    drawHelpLine(""," number, limit number of reconnections and");
+    drawHelpLine(""," choose transport (tcp by default, shm works on");
+    drawHelpLine(""," the same host only).");
+
+    drawHelpLine(" cconn <id> <ip>:<port> [port_nr] [retry <n>]"
+                 " [tcp|udp|shm]", " - create client");
+    drawHelpLine(""," port with specified id and try to connect to");
+    drawHelpLine(""," ip:address. You can optionally specify port");
+    drawHelpLine(""," number, limit number of reconnections and");
+    drawHelpLine(""," choose transport (tcp by default, shm works on");
+    drawHelpLine(""," the same host only).");
+
+    drawHelpLine(" close <id> <seconds>"," - close port with specified");
+    drawHelpLine(""," id for 'seconds' seconds.");
+
+    drawHelpLine(" kill <id>"," - permanently close port with specified");
+    drawHelpLine(""," id");
+
+    drawHelpLine(" timers <hello> <max_age> <forward_delay>", " - protocol");
+    drawHelpLine(""," timers in milliseconds (2000 20000 10000).");
+    drawHelpLine();
+
+    drawHelpLine(" * ", "Client commands:");
+    drawHelpLine(" port [port_nr] [tcp|udp|shm]",
+                 " - open client port, you");
+    drawHelpLine(""," can optionally specify port number and transport");
+
+    drawHelpLine(" conn <ip>:<port_nr> [port_nr] [tcp|udp|shm]",
+                 " - create client port");
+    drawHelpLine(""," and connect it to <ip>:<port_nr> bridge/client.");
+    drawHelpLine(""," You can specify your port number and transport.");
+
+    drawHelpLine(" send <id> <text>"," - send text to another client");
+    drawHelpLine(""," with specified id. Text longer than one letter");
+    drawHelpLine(""," needs peer with protocol v2.");
+
+    drawHelpLine(" bench <id> <bytes> [count]", " - send messages of");
+    drawHelpLine(""," given size, receiver shows transfer rate.");
+    drawHelpLine(" mtu <bytes>", " - size of message fragments");
+
+    drawHelpLine(" close <seconds>", " - close current port for 'second'");
+    drawHelpLine(""," seconds.");
+    drawHelpLine(" kill", " - kill current port");
+    drawHelpLine();
+    drawHelpLine(" * ", "Other commands:");
+    drawHelpLine(" exit/quit/q", " - close program");
+    drawHelpLine(" view <id>", " - show another node of topology loaded");
+    drawHelpLine(""," with --topology=<dir>");
+    drawHelpLine(" filter [o|c|-|<id>]", " - show only opened, closed or");
+    drawHelpLine(""," not connected ports, or port with given id");
+    drawHelpLine(" sort <id|status|port>", " - order of ports");
+    drawHelpLine(" PgUp/PgDn/Up/Down", " - scroll list of ports");
+    drawHelpLine();
+    drawHelpLine(" Type 'h' to see this message again...", "");
+
+    wnoutrefresh(m_helpWin);
+}
+
+void Display::clearLine(WINDOW *win, int y)
+{
+    wmove(win, y, 0);
+    int x = getmaxx(win);
+    for(int i = 0; i < x; ++i) waddch(win, ' ');
 }
 
 void Display::drawHelpLine(const string &cmd, const string &desc)
 {
-    attron(COLOR_PAIR(1));
-    clearLine(m_helpLineOffset);
-    attron(COLOR_PAIR(6));
-    attron(A_BOLD);
-    mvprintw(m_helpLineOffset,0,"%s", cmd.c_str());
-    attroff(A_BOLD);
-    attron(COLOR_PAIR(1));
-    printw("%s", desc.c_str());
+    wattron(m_helpWin, COLOR_PAIR(1));
+    clearLine(m_helpWin, m_helpLineOffset);
+    wattron(m_helpWin, COLOR_PAIR(6));
+    wattron(m_helpWin, A_BOLD);
+    mvwprintw(m_helpWin, m_helpLineOffset, 0, "%s", cmd.c_str());
+    wattroff(m_helpWin, A_BOLD);
+    wattron(m_helpWin, COLOR_PAIR(1));
+    wprintw(m_helpWin, "%s", desc.c_str());
     m_helpLineOffset++;
 }
+
+ConnectionInfo::ConnectionInfo(Display &display)
+    : m_display(display), m_published(nullptr), m_dirty(true),
+      m_msgDepth(display.getMsgDepth()), m_msgCount(0)
+{
+    m_state.status = Status::NOT_CONNECTED;
+    m_shown.status = Status::NOT_CONNECTED;
+    if (m_msgDepth) m_msgs.reset(new MsgSlot[m_msgDepth]);
+    for (size_t i = 0; i < m_msgDepth; ++i)
+        m_msgs[i].seq = 0;
+}
+
+ConnectionInfo::~ConnectionInfo()
+{
+    delete m_published.load();
+}
+
+void ConnectionInfo::publish(bool view)
+{
+    if (m_display.isHeadless()) return;
+
+    // State not taken by display yet is replaced
+    delete m_published.exchange(new State(m_state));
+    if (view) m_display.invalidateView();
+    m_dirty = true;
+}
+
+const ConnectionInfo::State& ConnectionInfo::getShown() const
+{
+    State *state = m_published.exchange(nullptr);
+    if (state) {
+        m_shown = *state;
+        delete state;
+    }
+    return m_shown;
+}
+
+void ConnectionInfo::addMsg(const MsgInfo &msg)
+{
+    if (m_display.isHeadless()) {
+        m_display.log("msg", m_state.port + " " + msg.header + msg.msg);
+        return;
+    }
+    m_display.logMsg(this, msg);
+    if (!m_msgDepth) return;
+
+    // Odd sequence number marks slot which is being written
+    size_t count = m_msgCount.load(memory_order_relaxed);
+    MsgSlot &slot = m_msgs[count % m_msgDepth];
+    unsigned seq = slot.seq.load(memory_order_relaxed);
+    slot.seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot.headerSize = min(msg.header.size(), sizeof(slot.header));
+    slot.msgSize = min(msg.msg.size(), sizeof(slot.msg));
+    memcpy(slot.header, msg.header.data(), slot.headerSize);
+    memcpy(slot.msg, msg.msg.data(), slot.msgSize);
+
+    slot.seq.store(seq + 2, memory_order_release);
+    m_msgCount.store(count + 1, memory_order_release);
+    m_dirty = true;
+}
+
+size_t ConnectionInfo::getMsgCount() const
+{
+    return min(m_msgCount.load(memory_order_acquire), m_msgDepth);
+}
+
+bool ConnectionInfo::getMsg(size_t age, MsgInfo &msg) const
+{
+    size_t count = m_msgCount.load(memory_order_acquire);
+    if (age >= min(count, m_msgDepth)) return false;
+
+    const MsgSlot &slot = m_msgs[(count - 1 - age) % m_msgDepth];
+    unsigned seq = slot.seq.load(memory_order_acquire);
+    if (seq & 1) return false;
+
+    char header[sizeof(slot.header)];
+    char data[sizeof(slot.msg)];
+    size_t headerSize = min<size_t>(slot.headerSize, sizeof(header));
+    size_t msgSize = min<size_t>(slot.msgSize, sizeof(data));
+    memcpy(header, slot.header, headerSize);
+    memcpy(data, slot.msg, msgSize);
+
+    // Slot was overwritten while copying
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.seq.load(memory_order_relaxed) != seq) return false;
+
+    msg.header.assign(header, headerSize);
+    msg.msg.assign(data, msgSize);
+    return true;
+}
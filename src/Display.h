@@ -3,35 +3,106 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <signal.h>
+#include <cstdio>
 
 class ConnectionInfo;
+struct MsgInfo;
+struct _win_st;
+typedef struct _win_st WINDOW;
 
 class Display
 {
 public:
-    Display();
+    // OFFSCREEN display only keeps state of a node, it can be drawn after
+    // some other display has initialized the terminal. HEADLESS display
+    // keeps no messages and logs title and errors as lines to stdout.
+    enum class Mode {
+        TERMINAL,
+        OFFSCREEN,
+        HEADLESS
+    };
+
+    Display(Mode mode = Mode::TERMINAL);
     ~Display();
 
+    // Every title (node state) is also written as a line to this file
+    // descriptor, so other processes can follow node state
+    void setStatusFD(int fd);
+
+    // Nodes skip formatting of messages nobody will see
+    bool isHeadless() const {
+        return m_mode == Mode::HEADLESS;
+    }
+
+    // Write "<kind> <text>" line to stdout, used by headless display.
+    // Prefix tells apart nodes sharing one stdout.
+    void log(const char *kind, const std::string &text);
+    void setLogPrefix(const std::string &prefix) {
+        m_logPrefix = prefix;
+    }
+
+    // Every port keeps only given number of last messages. Messages can be
+    // also appended to a log file, so older ones are not lost. Ports of
+    // headless display keep no messages, so they allocate no buffers.
+    void setMsgDepth(size_t depth) {
+        if (m_mode != Mode::HEADLESS) m_msgDepth = depth;
+    }
+    size_t getMsgDepth() const {
+        return m_msgDepth;
+    }
+    bool openMsgLog(const std::string &path);
+
+    // Only visible display asks for redraw
+    void setVisible(bool visible) {
+        m_visible = visible;
+        if (visible) invalidateLayout();
+    }
+
+    // Redraws are limited to given number of frames per second (0 means
+    // no limit)
+    void setFrameRate(unsigned fps) {
+        m_frameInterval = fps ? 1000 / fps : 0;
+    }
+
     void addConnection(const ConnectionInfo* conn);
     void rmConnection(const ConnectionInfo* conn);
 
+    // Connection list shows only ports with given status ("o", "c" or
+    // "-") or port id, empty filter shows all ports
+    void setFilter(const std::string &filter);
+
+    enum class Order {
+        ID,
+        STATUS,
+        PORT
+    };
+
+    void setOrder(Order order);
+
+    // Only visible part of connection list is drawn, it can be scrolled by
+    // panels or whole pages
+    void scrollPanels(int panels);
+    void scrollPages(int pages);
+
     std::mutex &getDrawMutex() {
         return m_drawMutex;
     }
    
-    void setTitle(const std::string &title) {
-        m_drawMutex.lock();
-        m_title = title;
-        m_drawMutex.unlock();
-    }
+    void setTitle(const std::string &title);
     const std::string& getTitle() const {
         return m_title;
     }
 
     void setDisplayHelp(bool help) {
         m_drawMutex.lock();
+        if (m_help != help) {
+            m_layoutDirty = true;
+            invalidate();
+        }
         m_help = help;
         m_drawMutex.unlock();
     }
@@ -39,25 +110,55 @@ public:
         return m_help;
     }
 
-    void setError(const std::string &error) {
-        m_drawMutex.lock();
-        m_error = error;
-        m_drawMutex.unlock();
-    }
+    void setError(const std::string &error);
     const std::string& getError() const {
         return m_error;
     }
 
     void setCmd(const std::string& cmd) {
         m_cmd = cmd;
+        invalidate();
     }
 
     void update();
+
+    // Marks display dirty, drawing thread is woken up only by first
+    // request after a redraw (thread safe)
     void queueUpdate();
 
+    // Marks display dirty from drawing thread
+    void invalidate() {
+        m_dirty = true;
+    }
+
+    // Whole screen is drawn again, e.g. after terminal was resized or
+    // other display was drawn
+    void invalidateLayout() {
+        m_drawMutex.lock();
+        m_layoutDirty = true;
+        m_drawMutex.unlock();
+        invalidate();
+    }
+
+    // Milliseconds until dirty display can be redrawn, -1 if it is clean
+    int getFrameDelay() const;
+
 private:
 
-    void clearLine(int x);
+    // Called by ConnectionInfo when it could change its place in list
+    friend class ConnectionInfo;
+    void invalidateView() {
+        m_viewDirty = true;
+    }
+    void logMsg(const ConnectionInfo *conn, const MsgInfo &msg);
+
+    void buildView();
+    bool isShown(const ConnectionInfo *conn) const;
+    void layout(int rows, int cols, size_t panels, int height);
+    void destroyWindows();
+    void drawConnection(WINDOW *win, const ConnectionInfo *conn);
+    void drawHelp();
+    void clearLine(WINDOW *win, int y);
     void drawHelpLine(const std::string &cmd = "", 
                       const std::string &desc = "");
 
@@ -66,9 +167,38 @@ private:
     std::string m_cmd;
     std::string m_title;
     std::string m_error;
+    std::string m_logPrefix;
     std::set<const ConnectionInfo*> m_conns;
     bool m_help;
+    Mode m_mode;
+    std::atomic<bool> m_visible;
+    int m_statusFD;
+    std::atomic<bool> m_dirty;
+    unsigned m_frameInterval;
+    unsigned long m_lastFrame;
     pthread_t m_drawingThread;
+    size_t m_msgDepth;
+    FILE *m_msgLog;
+
+    // Filtered and sorted connections, rebuilt only when ports are added,
+    // removed or change their status, id or port
+    std::vector<const ConnectionInfo*> m_view;
+    std::atomic<bool> m_viewDirty;
+    std::string m_filter;
+    Order m_order;
+    size_t m_first;
+
+    // Every part of screen has its own window, only changed windows are
+    // drawn and passed to terminal. Panel i shows m_panelConns[i].
+    bool m_layoutDirty;
+    int m_panelHeight;
+    int m_rows;
+    int m_cols;
+    WINDOW *m_titleWin;
+    WINDOW *m_promptWin;
+    WINDOW *m_helpWin;
+    std::vector<WINDOW*> m_panels;
+    std::vector<const ConnectionInfo*> m_panelConns;
 };
 
 struct MsgInfo {
@@ -76,11 +206,17 @@ struct MsgInfo {
     std::string msg;
 };
 
+// State of a port is written by event loop thread and drawn by display
+// thread without a common lock. Every change publishes a copy of state,
+// display takes the latest one. Messages are copied into a ring of fixed
+// slots protected by sequence numbers (seqlock), writer overwrites the
+// oldest slot and never waits for display.
 class ConnectionInfo
 {
 public:
     
-    ConnectionInfo(Display &display) : m_display(display) {}
+    ConnectionInfo(Display &display);
+    ~ConnectionInfo();
 
     enum class Status {
         NOT_CONNECTED,
@@ -88,93 +224,111 @@ public:
         CLOSED
     };
 
+    // Setters and getters are used by event loop thread only
     void setAddress(const std::string &address) {
-        m_display.getDrawMutex().lock();
-        m_address = address;
-        m_display.getDrawMutex().unlock();
+        m_state.address = address;
+        publish(false);
     }
     const std::string& getAddress() const {
-        return m_address;
+        return m_state.address;
     }
 
     void setClientAddress(const std::string &address) {
-        m_display.getDrawMutex().lock();
-        m_clientAddress = address;
-        m_display.getDrawMutex().unlock();
+        m_state.clientAddress = address;
+        publish(false);
     }
     const std::string& getClientAddress() const {
-        return m_clientAddress;
+        return m_state.clientAddress;
     }
 
     void setPort(const std::string &port) {
-        m_display.getDrawMutex().lock();
-        m_port = port;
-        m_display.getDrawMutex().unlock();
+        m_state.port = port;
+        publish(true);
     }
     const std::string& getPort() const {
-        return m_port;
+        return m_state.port;
     }
 
     void setClientPort(const std::string &port) {
-        m_display.getDrawMutex().lock();
-        m_clientPort = port;
-        m_display.getDrawMutex().unlock();
+        m_state.clientPort = port;
+        publish(false);
     }
     const std::string& getClientPort() const {
-        return m_clientPort;
+        return m_state.clientPort;
     }
 
     void setID(const std::string &id) {
-        m_display.getDrawMutex().lock();
-        m_id = id;
-        m_display.getDrawMutex().unlock();
+        m_state.id = id;
+        publish(true);
     }
     const std::string& getID() const {
-        return m_id;
+        return m_state.id;
     }
 
     void setClientID(const std::string &id) {
-        m_display.getDrawMutex().lock();
-        m_clientId = id;
-        m_display.getDrawMutex().unlock();
+        m_state.clientId = id;
+        publish(false);
     }
     const std::string& getClientID() const {
-        return m_clientId;
+        return m_state.clientId;
     }
 
     void setStatus(Status status) {
-        m_display.getDrawMutex().lock();
-        m_status = status;
-        m_display.getDrawMutex().unlock();
+        m_state.status = status;
+        publish(true);
     }
     Status getStatus() const {
-        return m_status;
+        return m_state.status;
     }
 
-    void addMsg(const MsgInfo &msg) {
-        m_display.getDrawMutex().lock();
-        m_msgs.push_back(msg);
-        m_display.getDrawMutex().unlock();
-    }
-
-    const std::vector<MsgInfo>& getMsgs() const {
-        return m_msgs;
-    }
+    void addMsg(const MsgInfo &msg);
 
 private:
 
-    Display &m_display;
+    // Display reads published state and messages
+    friend class Display;
+
+    struct State {
+        std::string address;
+        std::string port;
+        std::string id;
+
+        std::string clientAddress;
+        std::string clientPort;
+        std::string clientId;
+
+        Status status;
+    };
+
+    // Longer messages are shortened
+    struct MsgSlot {
+        std::atomic<unsigned> seq;
+        unsigned char headerSize;
+        unsigned char msgSize;
+        char header[62];
+        char msg[32];
+    };
 
-    std::string m_address;
-    std::string m_port;
-    std::string m_id;
+    // View is refreshed when port changes its place in list
+    void publish(bool view);
+
+    // Display thread only
+    const State& getShown() const;
+    size_t getMsgCount() const;
+    bool getMsg(size_t age, MsgInfo &msg) const;
+
+    Display &m_display;
+    State m_state;
 
-    std::string m_clientAddress;
-    std::string m_clientPort;
-    std::string m_clientId;
+    // Latest published state and copy used by display
+    mutable std::atomic<State*> m_published;
+    mutable State m_shown;
+    mutable std::atomic<bool> m_dirty;
 
-    Status m_status;
-    std::vector<MsgInfo> m_msgs;
+    // Ring of last messages, m_msgCount counts all written messages
+    std::unique_ptr<MsgSlot[]> m_msgs;
+    size_t m_msgDepth;
+    std::atomic<size_t> m_msgCount;
 };
 
 #endif
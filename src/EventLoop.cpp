@@ -0,0 +1,378 @@
+#include "EventLoop.h"
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+using namespace std;
+
+// Completions of asynchronous operations are marked with highest bit of
+// user data, polls use serial and file descriptor.
+static const uint64_t OPERATION_FLAG = 1ULL << 63;
+
+static unsigned long now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static uint64_t packPoll(int fd, uint32_t serial)
+{
+    return (static_cast<uint64_t>(serial) << 32) | static_cast<uint32_t>(fd);
+}
+
+EventLoop::EventLoop(Backend backend)
+    : m_backend(backend), m_lastOperation(0), m_epollFD(-1), m_thread(0),
+      m_running(false), m_stop(false), m_batches(0), m_serial(0),
+      m_timers(now()), m_timerArmed(0)
+{
+    if (m_backend == Backend::URING && !m_ring.setup(256))
+        m_backend = Backend::EPOLL;
+
+    if (m_backend == Backend::EPOLL)
+        m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    // Wake up descriptor is used to run posted tasks
+    add(m_wakeFD, EPOLLIN, [this](uint32_t) {
+        uint64_t value;
+        if (read(m_wakeFD, &value, sizeof(value)) == sizeof(value))
+            runTasks();
+    });
+
+    // Timing wheel is advanced when its next slot is due
+    m_timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    add(m_timerFD, EPOLLIN, [this](uint32_t) {
+        uint64_t value;
+        if (read(m_timerFD, &value, sizeof(value)) == sizeof(value))
+            runTimers();
+    });
+}
+
+EventLoop::~EventLoop()
+{
+    stop();
+
+    ::close(m_timerFD);
+    ::close(m_wakeFD);
+    if (m_epollFD != -1) ::close(m_epollFD);
+}
+
+void EventLoop::start()
+{
+    if (m_running) return;
+    m_stop = false;
+    m_running = true;
+    pthread_create(&m_thread, nullptr, &EventLoop::threadStart, this);
+}
+
+void EventLoop::stop()
+{
+    if (!m_running) return;
+
+    // Wake up loop from posted task so it can check stop flag
+    post([this]() { m_stop = true; });
+    pthread_join(m_thread, nullptr);
+    m_running = false;
+}
+
+void* EventLoop::threadStart(void *loop)
+{
+    EventLoop *l = reinterpret_cast<EventLoop*>(loop);
+    l->run();
+    return nullptr;
+}
+
+void EventLoop::run()
+{
+    if (m_backend == Backend::URING) {
+        runURing();
+        return;
+    }
+
+    epoll_event events[64];
+
+    while(!m_stop) {
+        int count = epoll_wait(m_epollFD, events, 64, -1);
+        if (count == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        for (int i = 0; i < count; ++i)
+            dispatch(events[i]);
+        runDeferred();
+        ++m_batches;
+    }
+}
+
+void EventLoop::runURing()
+{
+    while(!m_stop) {
+        // Pass all queued registrations and sends, wait for completion
+        if (m_ring.submit(1) == -1 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY)
+            return;
+
+        io_uring_cqe cqe;
+        while (m_ring.peek(cqe))
+            complete(cqe);
+        runDeferred();
+        ++m_batches;
+    }
+}
+
+void EventLoop::complete(const io_uring_cqe &cqe)
+{
+    // Poll removals and cancellations
+    if (cqe.user_data == 0) return;
+
+    if (cqe.user_data & OPERATION_FLAG) {
+        auto it = m_operations.find(cqe.user_data & ~OPERATION_FLAG);
+        if (it == m_operations.end()) return;
+
+        // Cancelled operation has no completion but keeps data until now
+        Operation operation = move(it->second);
+        m_operations.erase(it);
+        if (operation.done) operation.done(cqe.res, operation.data);
+        return;
+    }
+
+    int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+    uint32_t serial = static_cast<uint32_t>(cqe.user_data >> 32);
+
+    auto it = m_handlers.find(fd);
+    if (it == m_handlers.end() || it->second.serial != serial) return;
+    if (cqe.res < 0) return;
+
+    // Multishot poll can be terminated by kernel, arm it again
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+        armPoll(fd, it->second);
+
+    Handler handler = it->second.handler;
+    handler(static_cast<uint32_t>(cqe.res));
+}
+
+void EventLoop::dispatch(const epoll_event &event)
+{
+    int fd = static_cast<int>(event.data.u64 & 0xFFFFFFFF);
+    uint32_t serial = static_cast<uint32_t>(event.data.u64 >> 32);
+
+    // Handler could be removed (and fd reused) by previous event in batch
+    auto it = m_handlers.find(fd);
+    if (it == m_handlers.end() || it->second.serial != serial) return;
+
+    // Copy handler, it can unregister itself while running
+    Handler handler = it->second.handler;
+    handler(event.events);
+}
+
+void EventLoop::runTasks()
+{
+    vector<Task> tasks;
+    m_tasksMutex.lock();
+    tasks.swap(m_tasks);
+    m_tasksMutex.unlock();
+
+    for(auto &task : tasks)
+        task();
+}
+
+void EventLoop::runDeferred()
+{
+    // Deferred tasks can defer other tasks
+    while (!m_deferred.empty()) {
+        vector<Task> tasks;
+        tasks.swap(m_deferred);
+        for(auto &task : tasks)
+            task();
+    }
+}
+
+uint32_t EventLoop::nextSerial()
+{
+    // Serial never uses highest bit reserved for operations and is never 0
+    m_serial = (m_serial + 1) & 0x7FFFFFFF;
+    if (m_serial == 0) m_serial = 1;
+    return m_serial;
+}
+
+void EventLoop::armPoll(int fd, const Entry &entry)
+{
+    io_uring_sqe *sqe = m_ring.getSQE();
+    if (!sqe) return;
+
+    // Poll and epoll event masks have the same values
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = entry.events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = packPoll(fd, entry.serial);
+}
+
+void EventLoop::cancelPoll(int fd, const Entry &entry)
+{
+    io_uring_sqe *sqe = m_ring.getSQE();
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = packPoll(fd, entry.serial);
+    sqe->user_data = 0;
+}
+
+bool EventLoop::add(int fd, uint32_t events, const Handler &handler)
+{
+    Entry entry;
+    entry.serial = nextSerial();
+    entry.events = events;
+    entry.handler = handler;
+
+    if (m_backend == Backend::URING) {
+        if (m_handlers.count(fd)) return false;
+        armPoll(fd, entry);
+        m_handlers[fd] = entry;
+        return true;
+    }
+
+    epoll_event event;
+    event.events = events;
+    event.data.u64 = packPoll(fd, entry.serial);
+
+    if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, fd, &event) == -1)
+        return false;
+
+    m_handlers[fd] = entry;
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events)
+{
+    auto it = m_handlers.find(fd);
+    if (it == m_handlers.end()) return false;
+    if (it->second.events == events) return true;
+
+    if (m_backend == Backend::URING) {
+        // New serial makes late completions of old poll ignored
+        cancelPoll(fd, it->second);
+        it->second.serial = nextSerial();
+        it->second.events = events;
+        armPoll(fd, it->second);
+        return true;
+    }
+
+    epoll_event event;
+    event.events = events;
+    event.data.u64 = packPoll(fd, it->second.serial);
+
+    if (epoll_ctl(m_epollFD, EPOLL_CTL_MOD, fd, &event) == -1)
+        return false;
+
+    it->second.events = events;
+    return true;
+}
+
+void EventLoop::remove(int fd)
+{
+    auto it = m_handlers.find(fd);
+    if (it == m_handlers.end()) return;
+
+    if (m_backend == Backend::URING)
+        cancelPoll(fd, it->second);
+    else
+        epoll_ctl(m_epollFD, EPOLL_CTL_DEL, fd, nullptr);
+    m_handlers.erase(it);
+}
+
+void EventLoop::post(const Task &task)
+{
+    m_tasksMutex.lock();
+    m_tasks.push_back(task);
+    m_tasksMutex.unlock();
+
+    uint64_t value = 1;
+    if (write(m_wakeFD, &value, sizeof(value)) != sizeof(value)) {
+        // Counter is already signaled, loop will run the task anyway
+    }
+}
+
+void EventLoop::defer(const Task &task)
+{
+    m_deferred.push_back(task);
+}
+
+EventLoop::TimerID EventLoop::setTimer(unsigned milliseconds, const Task &task)
+{
+    TimerID id = m_timers.add(now() + milliseconds, task);
+    armTimer();
+    return id;
+}
+
+void EventLoop::cancelTimer(TimerID id)
+{
+    // Timerfd stays armed, wheel just finds nothing to run
+    m_timers.cancel(id);
+}
+
+void EventLoop::runTimers()
+{
+    m_timerArmed = 0;
+    m_timers.advance(now());
+    armTimer();
+}
+
+void EventLoop::armTimer()
+{
+    unsigned long next = m_timers.next();
+    if (!next || next == m_timerArmed) return;
+
+    // Time in the past expires immediately
+    itimerspec spec = {};
+    spec.it_value.tv_sec = next / 1000;
+    spec.it_value.tv_nsec = (next % 1000) * 1000000;
+    if (timerfd_settime(m_timerFD, TFD_TIMER_ABSTIME, &spec, nullptr) == 0)
+        m_timerArmed = next;
+}
+
+EventLoop::OperationID EventLoop::send(int fd, string &&data,
+                                       const Completion &done)
+{
+    if (m_backend != Backend::URING) return 0;
+
+    io_uring_sqe *sqe = m_ring.getSQE();
+    if (!sqe) return 0;
+
+    // Data lives in operation map until completion
+    OperationID id = ++m_lastOperation;
+    Operation &operation = m_operations[id];
+    operation.data = move(data);
+    operation.done = done;
+
+    // Kernel retries short sends, but send can still end early
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(operation.data.data());
+    sqe->len = operation.data.size();
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = OPERATION_FLAG | id;
+    return id;
+}
+
+void EventLoop::cancelOperation(OperationID id)
+{
+    auto it = m_operations.find(id);
+    if (it == m_operations.end()) return;
+
+    // Data must stay valid until kernel reports completion
+    it->second.done = nullptr;
+
+    io_uring_sqe *sqe = m_ring.getSQE();
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = OPERATION_FLAG | id;
+    sqe->user_data = 0;
+}
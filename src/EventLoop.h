@@ -0,0 +1,131 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+#include "TimerWheel.h"
+#include "URing.h"
+#include <sys/epoll.h>
+#include <pthread.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Epoll reactor which owns every socket and timer of a node. All handlers,
+// timers and posted tasks are executed on a single loop thread. Apart from
+// post() and stop(), methods should be called from the loop thread (or
+// when loop is not running).
+//
+// With URING backend readiness is reported by multishot polls and sends
+// can be submitted asynchronously, so registrations and sends made while
+// handling events are passed to kernel in one system call.
+class EventLoop
+{
+public:
+    typedef std::function<void(uint32_t)> Handler;
+    typedef std::function<void()> Task;
+    typedef std::function<void(int, std::string&)> Completion;
+    typedef TimerWheel::TimerID TimerID;
+    typedef unsigned long OperationID;
+
+    enum class Backend {
+        EPOLL,
+        URING
+    };
+
+    // Falls back to EPOLL if io_uring is not supported
+    EventLoop(Backend backend = Backend::EPOLL);
+    ~EventLoop();
+
+    Backend getBackend() const {
+        return m_backend;
+    }
+
+    // Number of handled batches of events (thread safe), does not change
+    // while loop is idle
+    unsigned long getBatches() const {
+        return m_batches;
+    }
+
+    // Start and stop loop thread
+    void start();
+    void stop();
+
+    // Register file descriptor with EPOLL* events mask
+    bool add(int fd, uint32_t events, const Handler &handler);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Queue task to be run on loop thread (thread safe)
+    void post(const Task &task);
+
+    // Run task on loop thread after current batch of events is handled,
+    // lets handlers coalesce work (e.g. many sends into one system call)
+    void defer(const Task &task);
+
+    // One shot timers with millisecond resolution, returned id is never 0.
+    // All timers share one timing wheel and timerfd.
+    TimerID setTimer(unsigned milliseconds, const Task &task);
+    void cancelTimer(TimerID id);
+
+    // Send data asynchronously (URING backend only). Data is owned by loop
+    // until completion is called with number of sent bytes or -errno, and
+    // is passed back so unsent part can be submitted again.
+    OperationID send(int fd, std::string &&data, const Completion &done);
+    void cancelOperation(OperationID id);
+
+private:
+
+    struct Entry {
+        uint32_t serial;
+        uint32_t events;
+        Handler handler;
+    };
+
+    struct Operation {
+        std::string data;
+        Completion done;
+    };
+
+    static void* threadStart(void *loop);
+    void run();
+    void runURing();
+    void dispatch(const epoll_event &event);
+    void complete(const io_uring_cqe &cqe);
+    void runTasks();
+    void runDeferred();
+    uint32_t nextSerial();
+
+    void runTimers();
+    void armTimer();
+
+    void armPoll(int fd, const Entry &entry);
+    void cancelPoll(int fd, const Entry &entry);
+
+    Backend m_backend;
+    URing m_ring;
+    OperationID m_lastOperation;
+    std::unordered_map<OperationID, Operation> m_operations;
+
+    int m_epollFD;
+    int m_wakeFD;
+
+    pthread_t m_thread;
+    bool m_running;
+    volatile bool m_stop;
+    std::atomic<unsigned long> m_batches;
+
+    uint32_t m_serial;
+    std::unordered_map<int, Entry> m_handlers;
+
+    TimerWheel m_timers;
+    int m_timerFD;
+    unsigned long m_timerArmed;
+
+    std::mutex m_tasksMutex;
+    std::vector<Task> m_tasks;
+    std::vector<Task> m_deferred;
+};
+
+#endif //EVENT_LOOP_H
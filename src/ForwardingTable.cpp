@@ -0,0 +1,91 @@
+#include "ForwardingTable.h"
+using namespace std;
+
+static const unsigned MIN_BITS = 4;
+
+ForwardingTable::ForwardingTable(unsigned long agingTime)
+    : m_agingTime(agingTime), m_entries(1 << MIN_BITS), m_bits(MIN_BITS),
+      m_used(0)
+{
+
+}
+
+void ForwardingTable::learn(uint32_t client, Port *port, unsigned long now)
+{
+    size_t mask = m_entries.size() - 1;
+    for (size_t i = slot(client); m_entries[i].port; i = (i + 1) & mask) {
+        Entry &entry = m_entries[i];
+        if (entry.client == client) {
+            entry.port = port;
+            entry.seen = now;
+            return;
+        }
+    }
+
+    // Keep at most half of slots used, aged entries go first
+    if ((m_used + 1) * 2 > m_entries.size()) {
+        rebuild([this, now](const Entry &entry) {
+            return now - entry.seen <= m_agingTime;
+        });
+        mask = m_entries.size() - 1;
+    }
+
+    size_t i = slot(client);
+    while (m_entries[i].port) i = (i + 1) & mask;
+    m_entries[i].port = port;
+    m_entries[i].client = client;
+    m_entries[i].seen = now;
+    ++m_used;
+}
+
+Port* ForwardingTable::find(uint32_t client, unsigned long now) const
+{
+    size_t mask = m_entries.size() - 1;
+    for (size_t i = slot(client); m_entries[i].port; i = (i + 1) & mask) {
+        const Entry &entry = m_entries[i];
+        if (entry.client != client) continue;
+        if (now - entry.seen > m_agingTime) return nullptr;
+        return entry.port;
+    }
+    return nullptr;
+}
+
+void ForwardingTable::remove(Port *port)
+{
+    rebuild([port](const Entry &entry) {
+        return entry.port != port;
+    });
+}
+
+void ForwardingTable::clear()
+{
+    if (!m_used) return;
+    m_entries.assign(1 << MIN_BITS, Entry());
+    m_bits = MIN_BITS;
+    m_used = 0;
+}
+
+template<typename Filter>
+void ForwardingTable::rebuild(Filter filter)
+{
+    vector<Entry> entries;
+    entries.swap(m_entries);
+
+    size_t used = 0;
+    for (const Entry &entry : entries)
+        if (entry.port && filter(entry)) ++used;
+
+    // Quarter of slots used after rebuild
+    m_bits = MIN_BITS;
+    while ((size_t(1) << m_bits) < used * 4) ++m_bits;
+    m_entries.assign(size_t(1) << m_bits, Entry());
+    m_used = used;
+
+    size_t mask = m_entries.size() - 1;
+    for (const Entry &entry : entries) {
+        if (!entry.port || !filter(entry)) continue;
+        size_t i = slot(entry.client);
+        while (m_entries[i].port) i = (i + 1) & mask;
+        m_entries[i] = entry;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef FORWARDING_TABLE_H
+#define FORWARDING_TABLE_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Port;
+
+// Ports on which clients were last seen. Entries are kept in one array with
+// linear probing, so lookup usually touches single cache line. Entries not
+// refreshed for aging time are ignored and dropped when table is rebuilt.
+class ForwardingTable
+{
+public:
+    // Aging time in milliseconds
+    ForwardingTable(unsigned long agingTime = 300000);
+
+    // Times are monotonic milliseconds
+    void learn(uint32_t client, Port *port, unsigned long now);
+    Port* find(uint32_t client, unsigned long now) const;
+
+    // Forget clients behind port, or all of them after topology change
+    void remove(Port *port);
+    void clear();
+
+    size_t size() const {
+        return m_used;
+    }
+
+private:
+
+    struct Entry {
+        Port *port;
+        uint32_t client;
+        unsigned long seen;
+    };
+
+    size_t slot(uint32_t client) const {
+        return (client * 2654435761u) >> (32 - m_bits);
+    }
+
+    // Copy entries accepted by filter to table sized for them
+    template<typename Filter>
+    void rebuild(Filter filter);
+
+    unsigned long m_agingTime;
+    std::vector<Entry> m_entries;
+    unsigned m_bits;
+    size_t m_used;
+};
+
+#endif //FORWARDING_TABLE_H
@@ -0,0 +1,187 @@
+#include "FrameDecoder.h"
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+FrameDecoder::FrameDecoder(const string &syncBytes, size_t frameSize,
+                           size_t capacity)
+    : m_sync(syncBytes), m_hunt(syncBytes + FRAME_MAGIC[0]),
+      m_frameSize(frameSize), m_buffer(capacity), m_head(0), m_tail(0),
+      m_strict(false), m_error(false)
+{
+
+}
+
+char* FrameDecoder::getWriteBuffer(size_t &space)
+{
+    // Move unread tail to the front when there is no room left
+    if (m_tail == m_buffer.size()) {
+        if (m_head == m_tail) {
+            m_head = m_tail = 0;
+        } else {
+            memmove(m_buffer.data(), m_buffer.data() + m_head,
+                    m_tail - m_head);
+            m_tail -= m_head;
+            m_head = 0;
+        }
+    }
+
+    space = m_buffer.size() - m_tail;
+    return m_buffer.data() + m_tail;
+}
+
+void FrameDecoder::commit(size_t size)
+{
+    m_tail += size;
+}
+
+static uint16_t checksum(const unsigned char *data, size_t size)
+{
+    // Fletcher-16, sums are reduced only every few hundred bytes
+    uint32_t sum1 = 0, sum2 = 0;
+    while (size) {
+        size_t block = size < 360 ? size : 360;
+        size -= block;
+        while (block--) {
+            sum1 += *data++;
+            sum2 += sum1;
+        }
+        sum1 %= 255;
+        sum2 %= 255;
+    }
+    return sum2 << 8 | sum1;
+}
+
+void FrameDecoder::encode(const char *frame, size_t size, string &out)
+{
+    out.resize(FRAME_HEADER_SIZE + size);
+    char *data = &out[0];
+    data[0] = FRAME_MAGIC[0];
+    data[1] = FRAME_MAGIC[1];
+    data[4] = FRAME_VERSION;
+    data[5] = size >> 8;
+    data[6] = size & 0xFF;
+    memcpy(data + FRAME_HEADER_SIZE, frame, size);
+
+    uint16_t sum = checksum(reinterpret_cast<unsigned char*>(data + 4),
+                            size + 3);
+    data[2] = sum >> 8;
+    data[3] = sum & 0xFF;
+}
+
+size_t FrameDecoder::parseHeader(const char *data, size_t size,
+                                 bool &complete) const
+{
+    complete = false;
+    if (size < FRAME_HEADER_SIZE) return 0;
+
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    size_t length = bytes[5] << 8 | bytes[6];
+    if (data[0] != FRAME_MAGIC[0] || data[1] != FRAME_MAGIC[1] ||
+        bytes[4] < FRAME_VERSION || length == 0 || length > FRAME_MAX_SIZE) {
+        complete = true;
+        return 0;
+    }
+
+    if (size < FRAME_HEADER_SIZE + length) return 0;
+    complete = true;
+
+    uint16_t sum = bytes[2] << 8 | bytes[3];
+    if (checksum(bytes + 4, length + 3) != sum) return 0;
+    return length;
+}
+
+bool FrameDecoder::next(Frame &frame)
+{
+    while (!m_error) {
+        const char *begin = m_buffer.data() + m_head;
+        const char *end = m_buffer.data() + m_tail;
+        size_t available = end - begin;
+        if (!available) return false;
+
+        // Version 2 frame is taken by its length
+        if (*begin == FRAME_MAGIC[0]) {
+            bool complete;
+            size_t size = parseHeader(begin, available, complete);
+            if (!complete) return false;
+            if (size) {
+                frame.data = begin + FRAME_HEADER_SIZE;
+                frame.size = size;
+                if (*frame.data != FRAME_HELLO) m_strict = true;
+                consume(FRAME_HEADER_SIZE + size);
+                return true;
+            }
+        } else if (!m_strict && m_sync.find(*begin) != string::npos) {
+            // Fast path, version 1 stream is in sync
+            if (available < m_frameSize) return false;
+            frame.data = begin;
+            frame.size = m_frameSize;
+            consume(m_frameSize);
+            return true;
+        }
+
+        // Peer speaking version 2 never sends garbage
+        if (m_strict) {
+            m_error = true;
+            return false;
+        }
+        m_head = findSync(begin + 1, end) - m_buffer.data();
+    }
+    return false;
+}
+
+bool FrameDecoder::parse(const char *data, size_t size, Frame &frame) const
+{
+    bool complete;
+    size_t length = parseHeader(data, size, complete);
+    if (length && size == FRAME_HEADER_SIZE + length) {
+        frame.data = data + FRAME_HEADER_SIZE;
+        frame.size = length;
+        return true;
+    }
+
+    if (size != m_frameSize || m_sync.find(*data) == string::npos)
+        return false;
+    frame.data = data;
+    frame.size = size;
+    return true;
+}
+
+void FrameDecoder::consume(size_t size)
+{
+    m_head += size;
+
+    // Empty buffer can start from the beginning
+    if (m_head == m_tail) m_head = m_tail = 0;
+}
+
+const char* FrameDecoder::findSync(const char *begin, const char *end) const
+{
+    // Version 1 sync bytes and first byte of version 2 magic
+    const string &sync = m_hunt;
+
+#ifdef __SSE2__
+    // Compare 16 bytes at once against every sync byte
+    if (sync.size() <= 4) {
+        __m128i bytes[4];
+        for (size_t i = 0; i < sync.size(); ++i)
+            bytes[i] = _mm_set1_epi8(sync[i]);
+        for (; end - begin >= 16; begin += 16) {
+            __m128i chunk =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+            __m128i found = _mm_setzero_si128();
+            for (size_t i = 0; i < sync.size(); ++i)
+                found = _mm_or_si128(found, _mm_cmpeq_epi8(chunk, bytes[i]));
+            int mask = _mm_movemask_epi8(found);
+            if (mask) return begin + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; begin != end; ++begin)
+        if (sync.find(*begin) != string::npos) return begin;
+    return end;
+}
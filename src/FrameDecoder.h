@@ -0,0 +1,83 @@
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+#include <string>
+#include <vector>
+
+// Frame of version 2 protocol:
+//   magic "ST" | checksum (2) | version (1) | length (2) | frame (length)
+// Numbers are big endian. Checksum (Fletcher-16) covers version, length
+// and frame. Frame itself starts with type byte like frames of version 1,
+// which have fixed size and no header.
+static const char FRAME_MAGIC[] = "ST";
+static const unsigned char FRAME_VERSION = 2;
+static const size_t FRAME_HEADER_SIZE = 7;
+static const size_t FRAME_MAX_SIZE = 16 * 1024;
+
+// Hello frame carries highest supported version, it is sent when port is
+// connected. It contains no sync bytes of version 1, so old peers skip it.
+static const char FRAME_HELLO = 'H';
+
+// View of a frame inside decoder buffer. Valid until next read into decoder.
+struct Frame {
+    const char *data;
+    size_t size;
+};
+
+// Splits received byte stream into frames. Data is received directly into
+// fixed size buffer and frames are returned without copying. Unread tail
+// is moved to the front only when end of the buffer is reached, so it
+// costs at most one frame per buffer.
+//
+// Version 1 frames have fixed size and start with one of sync bytes,
+// garbage between them is skipped. Once peer sends version 2 data frame
+// stream is trusted: frames are taken by their length and broken frame is
+// an error, there is no resynchronization.
+class FrameDecoder
+{
+public:
+    FrameDecoder(const std::string &syncBytes, size_t frameSize,
+                 size_t capacity = 64 * 1024);
+
+    // Free space for next read, commit() number of bytes written there
+    char* getWriteBuffer(size_t &space);
+    void commit(size_t size);
+
+    // Get next complete frame
+    bool next(Frame &frame);
+
+    // Stream of version 2 frames is broken, connection should be dropped
+    bool hasError() const {
+        return m_error;
+    }
+
+    void clear() {
+        m_head = m_tail = 0;
+        m_strict = false;
+        m_error = false;
+    }
+
+    // Check frame received as a whole (e.g. in a datagram)
+    bool parse(const char *data, size_t size, Frame &frame) const;
+
+    // Encode frame with version 2 header
+    static void encode(const char *frame, size_t size, std::string &out);
+
+private:
+
+    // Returns size of valid version 2 frame at data, 0 if there is none.
+    // Incomplete frame is reported by setting complete to false.
+    size_t parseHeader(const char *data, size_t size, bool &complete) const;
+    const char* findSync(const char *begin, const char *end) const;
+    void consume(size_t size);
+
+    std::string m_sync;
+    std::string m_hunt;
+    size_t m_frameSize;
+    std::vector<char> m_buffer;
+    size_t m_head;
+    size_t m_tail;
+    bool m_strict;
+    bool m_error;
+};
+
+#endif //FRAME_DECODER_H
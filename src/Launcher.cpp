@@ -0,0 +1,462 @@
+#include "Launcher.h"
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <boost/regex.hpp>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+// Give up waiting for listening ports after this time (in milliseconds)
+static const unsigned BIND_TIMEOUT = 10000;
+
+static unsigned long now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+Launcher::Launcher(const string &program, const vector<string> &options)
+    : m_program(program), m_options(options), m_startTime(now())
+{
+
+}
+
+Launcher::~Launcher()
+{
+    terminate();
+}
+
+unsigned Launcher::elapsed() const
+{
+    return now() - m_startTime;
+}
+
+bool Launcher::load(const string &dir)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d) return false;
+
+    vector<string> files;
+    while (dirent *entry = readdir(d)) {
+        if (entry->d_name[0] != '.')
+            files.push_back(dir + "/" + entry->d_name);
+    }
+    closedir(d);
+    sort(files.begin(), files.end());
+
+    // Listening commands with optional port number and transport
+    boost::regex portCmd("(bport|cport) [0-9]+ ?([0-9]+)?( (tcp|udp|shm))?");
+    boost::regex clientPortCmd("port ?([0-9]+)?( (tcp|udp|shm))?");
+    boost::cmatch cm;
+
+    for(auto &file : files) {
+        Process process;
+        process.file = file;
+        process.pid = 0;
+        process.input = -1;
+        process.status = -1;
+        process.started = false;
+        process.bridge = false;
+        process.id = 0;
+        process.root = 0;
+        process.working = false;
+
+        ifstream in(file);
+        string line;
+        while (getline(in, line)) {
+            if (line.empty()) continue;
+
+            // First command creates node
+            if (process.listenCommands.empty()) {
+                process.listenCommands.push_back(line);
+                continue;
+            }
+
+            Endpoint endpoint;
+            if (regex_match(line.c_str(), cm, portCmd)) {
+                process.listenCommands.push_back(line);
+                if (cm[2].matched) {
+                    endpoint.port = stoul(cm[2]);
+                    endpoint.transport = cm[4].matched ? cm[4] : "tcp";
+                    process.endpoints.push_back(endpoint);
+                }
+            } else if (regex_match(line.c_str(), cm, clientPortCmd)) {
+                process.listenCommands.push_back(line);
+                if (cm[1].matched) {
+                    endpoint.port = stoul(cm[1]);
+                    endpoint.transport = cm[3].matched ? cm[3] : "tcp";
+                    process.endpoints.push_back(endpoint);
+                }
+            } else {
+                process.connectCommands.push_back(line);
+            }
+        }
+
+        if (!process.listenCommands.empty())
+            m_processes.push_back(process);
+    }
+
+    return true;
+}
+
+bool Launcher::spawn(Process &process)
+{
+    int input[2];
+    if (pipe2(input, O_CLOEXEC) == -1) return false;
+
+    int status[2];
+    if (pipe2(status, O_CLOEXEC) == -1) {
+        close(input[0]);
+        close(input[1]);
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(input[0]);
+        close(input[1]);
+        close(status[0]);
+        close(status[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        // Interrupt from terminal goes only to launcher, it stops nodes
+        setsid();
+
+        // Node log is not interesting, only its status lines
+        int null = open("/dev/null", O_WRONLY);
+        if (null == -1) _exit(127);
+        dup2(input[0], STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        dup2(status[1], 3);
+
+        // Launcher blocks and ignores signals, node should get default
+        // handling
+        sigset_t sigset;
+        sigemptyset(&sigset);
+        sigprocmask(SIG_SETMASK, &sigset, nullptr);
+        signal(SIGPIPE, SIG_DFL);
+
+        vector<char*> argv;
+        argv.push_back(const_cast<char*>(m_program.c_str()));
+        for(auto &option : m_options)
+            argv.push_back(const_cast<char*>(option.c_str()));
+        argv.push_back(const_cast<char*>("--headless"));
+        argv.push_back(const_cast<char*>("--idle=0"));
+        argv.push_back(const_cast<char*>("--status-fd=3"));
+        argv.push_back(nullptr);
+
+        execv(m_program.c_str(), argv.data());
+        _exit(127);
+    }
+
+    close(input[0]);
+    close(status[1]);
+    fcntl(input[1], F_SETFL, fcntl(input[1], F_GETFL) | O_NONBLOCK);
+    fcntl(status[0], F_SETFL, fcntl(status[0], F_GETFL) | O_NONBLOCK);
+
+    process.pid = pid;
+    process.input = input[1];
+    process.status = status[0];
+    return true;
+}
+
+void Launcher::type(Process &process, const string &command)
+{
+    string line(command);
+    line += '\n';
+    if (write(process.input, line.data(), line.size()) == -1) {
+        // Node has exited, it is reported by status pipe
+    }
+}
+
+bool Launcher::isBound(const Endpoint &endpoint) const
+{
+    // Shared memory ports listen on abstract unix sockets
+    if (endpoint.transport == "shm") {
+        string name("@stp-shm-");
+        name += to_string(endpoint.port);
+
+        ifstream in("/proc/net/unix");
+        string line;
+        while (getline(in, line)) {
+            if (line.size() >= name.size() &&
+                line.compare(line.size() - name.size(), name.size(),
+                             name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Listening TCP sockets have state 0A, bound UDP sockets 07
+    bool udp = endpoint.transport == "udp";
+    const char *state = udp ? "07" : "0A";
+    const char *files[] = {
+        udp ? "/proc/net/udp" : "/proc/net/tcp",
+        udp ? "/proc/net/udp6" : "/proc/net/tcp6"
+    };
+
+    for(auto file : files) {
+        ifstream in(file);
+        string line;
+        getline(in, line);
+        while (getline(in, line)) {
+            istringstream fields(line);
+            string slot, local, remote, st;
+            fields >> slot >> local >> remote >> st;
+
+            auto pos = local.find(':');
+            if (pos == string::npos || st != state) continue;
+            if (strtoul(local.c_str() + pos + 1, nullptr, 16) == endpoint.port)
+                return true;
+        }
+    }
+    return false;
+}
+
+bool Launcher::readStatus(Process &process, bool &changed)
+{
+    char buffer[1024];
+    ssize_t size = read(process.status, buffer, sizeof(buffer));
+
+    // Status pipe is closed when node exits
+    if (size == 0) return false;
+    if (size == -1) return errno == EAGAIN || errno == EINTR;
+    process.statusBuffer.append(buffer, size);
+
+    size_t pos;
+    while ((pos = process.statusBuffer.find('\n')) != string::npos) {
+        string line = process.statusBuffer.substr(0, pos);
+        process.statusBuffer.erase(0, pos + 1);
+        process.started = true;
+
+        unsigned id, root, path;
+        char state[16];
+        if (sscanf(line.c_str(), " BRIDGE(%u) [root=%u, path=%u] State: %15s",
+                   &id, &root, &path, state) == 4) {
+            process.bridge = true;
+            process.id = id;
+            process.root = root;
+            process.working = strcmp(state, "Working") == 0;
+            changed = true;
+        }
+    }
+    return true;
+}
+
+void Launcher::reap(Process &process)
+{
+    waitpid(process.pid, nullptr, 0);
+    process.pid = 0;
+    close(process.input);
+    close(process.status);
+}
+
+bool Launcher::isConverged(unsigned &root) const
+{
+    // Every bridge is working and agrees on lowest bridge id as root
+    bool found = false;
+    unsigned lowest = 0;
+    for(auto &process : m_processes) {
+        if (!process.bridge || !process.pid) continue;
+        if (!process.working) return false;
+        if (!found || process.id < lowest) lowest = process.id;
+        found = true;
+    }
+    if (!found) return false;
+
+    for(auto &process : m_processes) {
+        if (process.bridge && process.pid && process.root != lowest)
+            return false;
+    }
+
+    root = lowest;
+    return true;
+}
+
+void Launcher::terminate()
+{
+    for(auto &process : m_processes) {
+        if (process.pid) type(process, "q");
+    }
+
+    // Give nodes a moment to close sockets
+    unsigned long deadline = now() + 1000;
+    for(auto &process : m_processes) {
+        if (!process.pid) continue;
+
+        while (waitpid(process.pid, nullptr, WNOHANG) == 0) {
+            if (now() >= deadline) {
+                kill(process.pid, SIGKILL);
+                break;
+            }
+            usleep(10000);
+        }
+        reap(process);
+    }
+}
+
+int Launcher::run(const string &dir)
+{
+    if (!load(dir) || m_processes.empty()) {
+        printf("Cannot load test folder %s\n", dir.c_str());
+        return 1;
+    }
+
+    // Interrupt stops all nodes instead of only launcher
+    sigset_t sigset;
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigset, nullptr);
+    int signals = signalfd(-1, &sigset, SFD_CLOEXEC);
+
+    // Typing to exited node must not kill launcher
+    signal(SIGPIPE, SIG_IGN);
+
+    for(auto &process : m_processes) {
+        if (!spawn(process)) {
+            printf("Cannot start node %s: %s\n", process.file.c_str(),
+                   strerror(errno));
+            return 1;
+        }
+    }
+    printf("[%6u ms] Started %zu nodes\n", elapsed(), m_processes.size());
+    fflush(stdout);
+
+    enum class Phase {
+        STARTING,
+        BINDING,
+        RUNNING
+    } phase = Phase::STARTING;
+
+    unsigned long bindStart = 0;
+    bool converged = false;
+    bool quit = false;
+    bool input = true;
+
+    while (!quit) {
+        vector<pollfd> fds;
+        pollfd fd;
+        fd.events = POLLIN;
+        fd.fd = input ? STDIN_FILENO : -1;
+        fds.push_back(fd);
+        fd.fd = signals;
+        fds.push_back(fd);
+        for(auto &process : m_processes) {
+            fd.fd = process.pid ? process.status : -1;
+            fds.push_back(fd);
+        }
+
+        if (poll(fds.data(), fds.size(), 50) == -1 && errno != EINTR)
+            break;
+
+        if (fds[0].revents) {
+            char buffer[256];
+            ssize_t size = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (size <= 0) input = false;
+            else if (buffer[0] == 'q') quit = true;
+        }
+        if (fds[1].revents) quit = true;
+
+        bool changed = false;
+        for (size_t i = 0; i < m_processes.size(); ++i) {
+            Process &process = m_processes[i];
+            if (!process.pid) continue;
+
+            if (fds[2 + i].revents && !readStatus(process, changed)) {
+                printf("[%6u ms] Node %s exited\n", elapsed(),
+                       process.file.c_str());
+                reap(process);
+                changed = true;
+                continue;
+            }
+
+            // Send listening commands once node has reported its state
+            if (process.started && phase == Phase::STARTING) {
+                while (!process.listenCommands.empty()) {
+                    type(process, process.listenCommands.front());
+                    process.listenCommands.pop_front();
+                }
+            }
+
+        }
+
+        if (phase == Phase::STARTING) {
+            bool started = true;
+            for(auto &process : m_processes)
+                started = started && (process.started || !process.pid);
+            if (started) {
+                phase = Phase::BINDING;
+                bindStart = now();
+            }
+        }
+
+        if (phase == Phase::BINDING) {
+            // Connecting nodes are started only when there is something
+            // to connect to
+            vector<string> missing;
+            for(auto &process : m_processes) {
+                for(auto &endpoint : process.endpoints) {
+                    if (process.pid && !isBound(endpoint))
+                        missing.push_back(to_string(endpoint.port));
+                }
+            }
+
+            bool timeout = now() - bindStart >= BIND_TIMEOUT;
+            if (!missing.empty() && !timeout) continue;
+
+            if (missing.empty()) {
+                printf("[%6u ms] All listening ports are bound\n", elapsed());
+            } else {
+                printf("[%6u ms] Ports not bound:", elapsed());
+                for(auto &port : missing)
+                    printf(" %s", port.c_str());
+                printf("\n");
+            }
+
+            for(auto &process : m_processes) {
+                while (process.pid && !process.connectCommands.empty()) {
+                    type(process, process.connectCommands.front());
+                    process.connectCommands.pop_front();
+                }
+            }
+            printf("[%6u ms] Connecting nodes\n", elapsed());
+            fflush(stdout);
+            phase = Phase::RUNNING;
+        }
+
+        if (phase == Phase::RUNNING && changed) {
+            unsigned root;
+            if (isConverged(root)) {
+                if (!converged)
+                    printf("[%6u ms] Spanning tree converged, root=%u\n",
+                           elapsed(), root);
+                converged = true;
+            } else if (converged) {
+                printf("[%6u ms] Topology changed\n", elapsed());
+                converged = false;
+            }
+            fflush(stdout);
+        }
+    }
+
+    terminate();
+    close(signals);
+    printf("[%6u ms] Stopped\n", elapsed());
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+#include <sys/types.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Starts every node of a test folder as separate headless stp process
+// reading commands from a pipe. Listening ports are created first,
+// connecting commands are typed only after all listening ports are bound.
+// Nodes report their titles through status pipe, which is used to report
+// when spanning tree has converged.
+class Launcher
+{
+public:
+    // Program is started with given options and status pipe
+    Launcher(const std::string &program,
+             const std::vector<std::string> &options);
+    ~Launcher();
+
+    // Runs until 'q' is entered or launcher is interrupted
+    int run(const std::string &dir);
+
+private:
+
+    struct Endpoint {
+        unsigned port;
+        std::string transport;
+    };
+
+    struct Process {
+        std::string file;
+        pid_t pid;
+        int input;
+        int status;
+        std::string statusBuffer;
+
+        std::deque<std::string> listenCommands;
+        std::deque<std::string> connectCommands;
+        std::vector<Endpoint> endpoints;
+
+        // Last reported state
+        bool started;
+        bool bridge;
+        unsigned id;
+        unsigned root;
+        bool working;
+    };
+
+    bool load(const std::string &dir);
+    bool spawn(Process &process);
+    void type(Process &process, const std::string &command);
+    bool isBound(const Endpoint &endpoint) const;
+    bool readStatus(Process &process, bool &changed);
+    void reap(Process &process);
+    bool isConverged(unsigned &root) const;
+    void terminate();
+    unsigned elapsed() const;
+
+    std::string m_program;
+    std::vector<std::string> m_options;
+    std::vector<Process> m_processes;
+    unsigned long m_startTime;
+};
+
+#endif //LAUNCHER_H
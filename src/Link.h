@@ -0,0 +1,40 @@
+#ifndef LINK_H
+#define LINK_H
+#include <cstddef>
+
+class Port;
+
+// Transport used by port to exchange frames with its peer. Link reports
+// its state back to the port (Port::established(), Port::restart(), ...),
+// so BridgePort/ClientPort logic doesn't depend on transport.
+class Link
+{
+public:
+    Link(Port &port) : m_port(port) {}
+    virtual ~Link() {}
+
+    // Start connecting or listening. Listening link which is already bound
+    // only starts waiting for peers again.
+    virtual void open() = 0;
+
+    // Close connection. Listening link stays bound, but stops accepting.
+    virtual void close() = 0;
+
+    // Link is still bound and can accept next peer after close
+    virtual bool isListening() const {
+        return false;
+    }
+
+    // Send frame, never blocks. Returns false if frame has been dropped.
+    virtual bool send(const char *msg, size_t size) = 0;
+
+    // Bytes waiting to be sent
+    virtual size_t getQueuedBytes() const {
+        return 0;
+    }
+
+protected:
+    Port &m_port;
+};
+
+#endif //LINK_H
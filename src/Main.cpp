@@ -1,34 +1,313 @@
 #include "Display.h"
 #include "Bridge.h"
 #include "Client.h"
+#include "EventLoop.h"
+#include "Launcher.h"
 #include <string>
 #include <unistd.h>
 #include <sys/signalfd.h>
+#include <poll.h>
+#include <time.h>
 #include <signal.h>
 #include <ncurses.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cerrno>
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <map>
 using namespace std;
 
+// Read all commands from file line by line
+static deque<string> readCommands(const string &path)
+{
+    deque<string> commands;
+    ifstream file(path);
+    while (file.good()) {
+        char buffer[256];
+        file.getline(buffer, 255);
+        commands.push_back(buffer);
+    }
+    return commands;
+}
+
+// Parse "client <id>" or "bridge <id>" command
+static bool parseNode(const string &in, string &type, unsigned &id)
+{
+    // Check if at least there are two strings
+    auto pos = in.find_first_of(" ");
+    if (pos == string::npos || pos+1 >= in.length()) return false;
+
+    type = in.substr(0, pos);
+    try {
+        id = stoul(in.substr(pos+1));
+    } catch (exception &e) {
+        return false;
+    }
+    return true;
+}
+
+// Create node from "client <id>" or "bridge <id>" command
+static Node* createNode(const string &in, Display &display, EventLoop &loop)
+{
+    string c;
+    unsigned val;
+    if (!parseNode(in, c, val)) return nullptr;
+
+    if (c.compare("client") == 0)
+        return new Client(val, display, loop);
+    if (c.compare("bridge") == 0)
+        return new Bridge(val, display, loop);
+    return nullptr;
+}
+
+// Every file of topology directory describes one node. Nodes are created
+// in this process and linked in memory, their commands are queued for
+// event loop. Lines of headless displays are prefixed with node id.
+static bool loadTopology(const string &dir, EventLoop &loop,
+                         map<unsigned, Node*> &nodes,
+                         map<unsigned, Display*> &displays,
+                         Display::Mode mode)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d) return false;
+
+    vector<string> files;
+    while (dirent *entry = readdir(d)) {
+        if (entry->d_name[0] != '.')
+            files.push_back(dir + "/" + entry->d_name);
+    }
+    closedir(d);
+    sort(files.begin(), files.end());
+
+    for(auto &path : files) {
+        deque<string> commands = readCommands(path);
+        if (commands.empty()) continue;
+
+        string type;
+        unsigned id;
+        if (!parseNode(commands.front(), type, id)) continue;
+
+        Display *display = new Display(mode);
+        if (mode == Display::Mode::HEADLESS)
+            display->setLogPrefix(to_string(id) + " ");
+        Node *node = createNode(commands.front(), *display, loop);
+        if (!node || nodes.count(node->getID())) {
+            delete node;
+            delete display;
+            continue;
+        }
+        commands.pop_front();
+
+        node->setTransport(Port::Transport::MEMORY);
+        nodes[node->getID()] = node;
+        displays[node->getID()] = display;
+        for(auto &in : commands)
+            loop.post([node, in]() { node->handleCommand(in); });
+    }
+
+    return true;
+}
+
+static unsigned long now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool isExitCommand(const string &in)
+{
+    return in.compare("exit") == 0 || in.compare("quit") == 0 ||
+           in.compare("q") == 0;
+}
+
+// Runs node without terminal. Commands are taken from history and then
+// from standard input. Node exits on exit command or when its event loop
+// was idle for given number of seconds (0 means never). With topology
+// every node of it is run, commands go to node chosen by "view <id>".
+static int runHeadless(deque<string> &history, EventLoop::Backend backend,
+                       int statusFD, unsigned idle, const string &topology)
+{
+    Display display(Display::Mode::HEADLESS);
+    if (statusFD != -1) display.setStatusFD(statusFD);
+    display.setTitle(" EMPTY NODE");
+    Node *node = nullptr;
+    map<unsigned, Node*> nodes;
+    map<unsigned, Display*> displays;
+
+    EventLoop loop(backend);
+    if (loop.getBackend() != backend)
+        display.setError("io_uring is not supported, using epoll");
+
+    if (!topology.empty()) {
+        if (!loadTopology(topology, loop, nodes, displays,
+                          Display::Mode::HEADLESS) || nodes.empty()) {
+            display.setError("Cannot load topology");
+            return 1;
+        }
+        node = nodes.begin()->second;
+        for(auto &d : displays)
+            if (statusFD != -1) d.second->setStatusFD(statusFD);
+    }
+    loop.start();
+
+    bool input = true;
+    bool exit = false;
+    string buffer;
+    unsigned long batches = loop.getBatches();
+    unsigned long lastActivity = now();
+    while (!exit) {
+        // Run every queued command
+        while (!history.empty() && !exit) {
+            string in = history.front();
+            history.pop_front();
+            if (isExitCommand(in)) {
+                exit = true;
+            } else if (!nodes.empty() && in.compare(0, 5, "view ") == 0) {
+                auto it = nodes.end();
+                try {
+                    it = nodes.find(stoul(in.substr(5)));
+                } catch (exception &e) {
+                }
+
+                if (it != nodes.end())
+                    node = it->second;
+                else
+                    display.setError("No such node");
+            } else if (node) {
+                loop.post([node, in]() { node->handleCommand(in); });
+            } else if (!in.empty() && !(node = createNode(in, display, loop))) {
+                display.setError("Unknown node: " + in);
+            }
+        }
+        if (exit) break;
+
+        // Wait for more input, but check idle time periodically
+        pollfd fd = {STDIN_FILENO, POLLIN, 0};
+        int res = poll(&fd, input ? 1 : 0, 100);
+        if (res == -1 && errno != EINTR) break;
+        if (res > 0) {
+            char chunk[256];
+            ssize_t size = read(STDIN_FILENO, chunk, sizeof(chunk));
+            if (size <= 0) {
+                input = false;
+                if (!buffer.empty()) history.push_back(buffer);
+            } else {
+                buffer.append(chunk, size);
+            }
+
+            size_t pos;
+            while ((pos = buffer.find('\n')) != string::npos) {
+                history.push_back(buffer.substr(0, pos));
+                buffer.erase(0, pos + 1);
+            }
+        }
+
+        if (loop.getBatches() != batches || !history.empty()) {
+            batches = loop.getBatches();
+            lastActivity = now();
+        } else if (idle && now() - lastActivity >= idle * 1000UL) {
+            exit = true;
+        }
+    }
+
+    loop.stop();
+    if (nodes.empty()) delete node;
+    for(auto &n : nodes)
+        delete n.second;
+    for(auto &d : displays)
+        delete d.second;
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    // Only argument is file for commands history
+    // Options are followed by optional file for commands history
     deque<string> history;
-    if (argc == 2) {
-        //Open file and read all command line by line
-        ifstream file(argv[1]);
-        while (file.good()) {
-            char buffer[256];
-            file.getline(buffer, 255);
-            history.push_back(buffer); 
-        } 
+    string topology;
+    string launch;
+    vector<string> options;
+    int statusFD = -1;
+    bool headless = false;
+    unsigned idle = 0;
+    unsigned fps = 20;
+    size_t msgDepth = 128;
+    string msgLog;
+    EventLoop::Backend backend = EventLoop::Backend::EPOLL;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg.compare("--io=epoll") == 0) {
+            backend = EventLoop::Backend::EPOLL;
+            options.push_back(arg);
+            continue;
+        }
+        if (arg.compare("--io=uring") == 0) {
+            backend = EventLoop::Backend::URING;
+            options.push_back(arg);
+            continue;
+        }
+        if (arg.compare(0, 11, "--topology=") == 0) {
+            topology = arg.substr(11);
+            continue;
+        }
+        if (arg.compare(0, 9, "--launch=") == 0) {
+            launch = arg.substr(9);
+            continue;
+        }
+        if (arg.compare("--headless") == 0) {
+            headless = true;
+            continue;
+        }
+        if (arg.compare(0, 6, "--fps=") == 0) {
+            fps = atoi(arg.c_str() + 6);
+            continue;
+        }
+        if (arg.compare(0, 12, "--msg-depth=") == 0) {
+            msgDepth = atoi(arg.c_str() + 12);
+            continue;
+        }
+        if (arg.compare(0, 10, "--msg-log=") == 0) {
+            msgLog = arg.substr(10);
+            continue;
+        }
+        if (arg.compare(0, 7, "--idle=") == 0) {
+            idle = atoi(arg.c_str() + 7);
+            continue;
+        }
+        if (arg.compare(0, 12, "--status-fd=") == 0) {
+            statusFD = atoi(arg.c_str() + 12);
+            continue;
+        }
+
+        history = readCommands(arg);
     }
 
+    // Start every node of test folder as separate process
+    if (!launch.empty()) {
+        Launcher launcher("/proc/self/exe", options);
+        return launcher.run(launch);
+    }
+
+    // Node without terminal, e.g. for scripts and many nodes on one host
+    if (headless)
+        return runHeadless(history, backend, statusFD, idle, topology);
+
     Display display;
+    display.setFrameRate(fps);
+    display.setMsgDepth(msgDepth);
+    if (!msgLog.empty() && !display.openMsgLog(msgLog))
+        display.setError("Cannot open message log");
+    if (statusFD != -1) display.setStatusFD(statusFD);
     display.setTitle(" EMPTY NODE - SR 2014 - by Przemysław Lenart");
     Node *node = nullptr;
 
+    // Nodes of topology loaded into this process, one of them is shown
+    map<unsigned, Node*> nodes;
+    map<unsigned, Display*> displays;
+    Display *shown = &display;
+
     // Create file descriptor from signal
     sigset_t sigset;
     sigemptyset(&sigset);
@@ -39,19 +318,56 @@ int main(int argc, char *argv[])
     int drawSignal = signalfd(-1, &sigset, 0);
     if (drawSignal == -1) return 1;
 
+    // All node sockets and timers are handled by event loop thread
+    EventLoop loop(backend);
+    if (loop.getBackend() != backend)
+        display.setError("io_uring is not supported, using epoll");
+
+    if (!topology.empty()) {
+        if (!loadTopology(topology, loop, nodes, displays,
+                          Display::Mode::OFFSCREEN) || nodes.empty()) {
+            display.setError("Cannot load topology");
+        } else {
+            node = nodes.begin()->second;
+            shown = displays.begin()->second;
+            shown->setVisible(true);
+        }
+        for(auto &d : displays) {
+            d.second->setFrameRate(fps);
+            d.second->setMsgDepth(msgDepth);
+            if (!msgLog.empty()) d.second->openMsgLog(msgLog);
+        }
+    }
+    loop.start();
+
     bool exit = false; 
     string in;
     while(!exit) {
-        display.update();
+        // Many update requests are drawn as one frame
+        int delay = shown->getFrameDelay();
+        if (delay == 0) {
+            shown->update();
+            delay = -1;
+        }
+
         // If there are no commands in history buffer
         if (history.empty()) {
-            // Select used for input / drawing events
+            // Select used for input / drawing events, waits for next
+            // frame if display is dirty
             fd_set set;
             FD_ZERO(&set);
             FD_SET(STDIN_FILENO, &set);
             FD_SET(drawSignal, &set);
-            if (select(drawSignal + 1, &set, nullptr, nullptr, nullptr) == -1)
+            timeval timeout;
+            timeout.tv_sec = delay / 1000;
+            timeout.tv_usec = (delay % 1000) * 1000;
+            int res = select(drawSignal + 1, &set, nullptr, nullptr,
+                             delay >= 0 ? &timeout : nullptr);
+            if (res == -1) {
+                if (errno == EINTR) continue;
                 return 1;
+            }
+            if (res == 0) continue;
 
             // If it was only signal for drawing don't parse input
             if (FD_ISSET(drawSignal, &set)) {
@@ -60,19 +376,28 @@ int main(int argc, char *argv[])
                 if (si.ssi_signo == SIGWINCH) {
                     endwin();
                     refresh();
+                    shown->invalidateLayout();
                 }
                 continue;
             }
 
-            // Get characters
+            // Get characters, keys scroll list of ports
             int c = getch();
+            if (c == KEY_UP || c == KEY_DOWN) {
+                shown->scrollPanels(c == KEY_UP ? -1 : 1);
+                continue;
+            }
+            if (c == KEY_PPAGE || c == KEY_NPAGE) {
+                shown->scrollPages(c == KEY_PPAGE ? -1 : 1);
+                continue;
+            }
             if (c != '\n') {
                 if (isprint(c))
                     in += c;
                 if (c == 8 || c == 127 || c == 263)
                     if(!in.empty()) in.pop_back();
 
-                display.setCmd(in);
+                shown->setCmd(in);
                 continue;
             }
         } else {
@@ -82,47 +407,61 @@ int main(int argc, char *argv[])
         }
 
         // Clear last error
-        if (!display.getError().empty()) display.setError("");
+        if (!shown->getError().empty()) shown->setError("");
 
         if (in.compare("h") == 0)
-            display.setDisplayHelp(true);
+            shown->setDisplayHelp(true);
         else
-            display.setDisplayHelp(false);
+            shown->setDisplayHelp(false);
 
-        if (in.compare("exit") == 0 || in.compare("quit") == 0 ||
-            in.compare("q") == 0) {
-            exit = true;
-        }
+        if (isExitCommand(in)) exit = true;
 
-        if (node)
-            node->handleCommand(in);
-        else {
-            // Check if at least there are two strings
-            auto pos = in.find_first_of(" ");
-            if (pos != string::npos && pos+1 < in.length()) {
-                auto c = in.substr(0, pos);
-                bool valid = true;
-                unsigned val;
-                try {
-                    val = stoul(in.substr(pos+1));
-                } catch (exception &e) {
-                    valid = false;
-                }
+        // Switch to another node of topology
+        if (!nodes.empty() && in.compare(0, 5, "view ") == 0) {
+            auto it = displays.end();
+            try {
+                it = displays.find(stoul(in.substr(5)));
+            } catch (exception &e) {
+            }
 
-                if (valid) {
-                    if (c.compare("client") == 0)
-                        node = new Client(val, display);
-                    if (c.compare("bridge") == 0)
-                        node = new Bridge(val, display);
-                }
+            if (it != displays.end()) {
+                shown->setVisible(false);
+                shown = it->second;
+                shown->setVisible(true);
+                node = nodes[it->first];
+            } else {
+                shown->setError("No such node");
             }
+        } else if (in.compare("filter") == 0) {
+            shown->setFilter("");
+        } else if (in.compare(0, 7, "filter ") == 0) {
+            shown->setFilter(in.substr(7));
+        } else if (in.compare(0, 5, "sort ") == 0) {
+            string order = in.substr(5);
+            if (order.compare("id") == 0)
+                shown->setOrder(Display::Order::ID);
+            else if (order.compare("status") == 0)
+                shown->setOrder(Display::Order::STATUS);
+            else if (order.compare("port") == 0)
+                shown->setOrder(Display::Order::PORT);
+            else
+                shown->setError("Unknown order");
+        } else if (node) {
+            loop.post([node, in]() { node->handleCommand(in); });
+        } else {
+            node = createNode(in, display, loop);
         }
 
         in.clear();
-        display.setCmd(in);
+        shown->setCmd(in);
     }
-    
-    if (node) delete node;
+
+    loop.stop();
+    if (nodes.empty()) delete node;
+    for(auto &n : nodes)
+        delete n.second;
+    for(auto &d : displays)
+        delete d.second;
 
     return 0;
 }
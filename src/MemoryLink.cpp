@@ -0,0 +1,204 @@
+#include "MemoryLink.h"
+#include "Port.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+using namespace std;
+
+// Listening links by port number. Used only from event loop thread.
+static unordered_map<unsigned, MemoryLink*> listeners;
+
+// Port numbers for links without one
+static unsigned nextAddress = 49152;
+
+static unsigned freeAddress()
+{
+    while (listeners.count(nextAddress)) ++nextAddress;
+    return nextAddress++;
+}
+
+MemoryLink::MemoryLink(Port &port)
+    : Link(port), m_loop(port.getLoop()), m_address(0), m_accepting(false),
+      m_peer(nullptr), m_hungUp(false), m_deliveryQueued(false),
+      m_alive(make_shared<bool>(true))
+{
+
+}
+
+MemoryLink::~MemoryLink()
+{
+    close();
+
+    auto it = listeners.find(m_address);
+    if (it != listeners.end() && it->second == this)
+        listeners.erase(it);
+}
+
+void MemoryLink::open()
+{
+    // Peer accepted by other link is already paired
+    if (m_peer) {
+        m_port.established();
+        return;
+    }
+
+    if (m_port.getConnectionType() == Port::ConnectionType::SERVER) {
+        if (!listen()) m_port.restart();
+        return;
+    }
+
+    connect();
+}
+
+void MemoryLink::close()
+{
+    // Peer notices hang up after current batch of events
+    if (m_peer) {
+        m_peer->m_peer = nullptr;
+        m_peer->hangUp();
+        m_peer = nullptr;
+    }
+
+    // Listening link stays registered, but refuses connections
+    m_accepting = false;
+    m_hungUp = false;
+    m_inbox.clear();
+}
+
+bool MemoryLink::listen()
+{
+    // Registered already, accept peers again
+    if (m_address) {
+        m_accepting = true;
+        return true;
+    }
+
+    unsigned address = m_port.getPort();
+    if (!address) address = freeAddress();
+
+    if (listeners.count(address)) {
+        errno = EADDRINUSE;
+        m_port.unixError("Cannot bind a socket");
+        return false;
+    }
+
+    m_address = address;
+    m_accepting = true;
+    listeners[m_address] = this;
+
+    // Update information
+    m_port.updateAddress("mem", m_address);
+    return true;
+}
+
+void MemoryLink::connect()
+{
+    unsigned address = m_port.getPort();
+    if (!address) address = freeAddress();
+
+    m_port.updateAddress("mem", address);
+    m_port.updateClientAddress("mem", m_port.getClientPort());
+
+    auto it = listeners.find(m_port.getClientPort());
+    if (it == listeners.end() || !it->second->accept(this)) {
+        errno = ECONNREFUSED;
+        m_port.unixError("Connection error");
+        m_port.restart();
+        return;
+    }
+
+    m_port.established();
+}
+
+bool MemoryLink::accept(MemoryLink *client)
+{
+    if (!m_accepting) return false;
+
+    // First peer is handled by this port
+    if (!m_peer) {
+        pair(client);
+        m_port.updateClientAddress("mem", client->m_port.getPort());
+        m_port.established();
+        return true;
+    }
+
+    // Other peers get their own logical ports
+    Port *peer = m_port.createPeerPort();
+    if (!peer) {
+        m_port.portMsg("Peer rejected, port is already connected");
+        return false;
+    }
+
+    MemoryLink *link = new MemoryLink(*peer);
+    link->pair(client);
+    peer->updateClientAddress("mem", client->m_port.getPort());
+    return m_port.addPeerPort(peer, link);
+}
+
+void MemoryLink::pair(MemoryLink *peer)
+{
+    m_peer = peer;
+    m_hungUp = false;
+    peer->m_peer = this;
+    peer->m_hungUp = false;
+}
+
+void MemoryLink::hangUp()
+{
+    m_hungUp = true;
+
+    weak_ptr<bool> alive = m_alive;
+    m_loop.defer([this, alive]() {
+        // Link could be paired again in the meantime
+        if (alive.expired() || !m_hungUp) return;
+        m_hungUp = false;
+        m_port.restart();
+    });
+}
+
+bool MemoryLink::send(const char *msg, size_t size)
+{
+    if (!m_peer) return false;
+
+    MemoryLink *peer = m_peer;
+    peer->m_inbox.append(msg, size);
+    if (peer->m_deliveryQueued) return true;
+
+    peer->m_deliveryQueued = true;
+    weak_ptr<bool> alive = peer->m_alive;
+    m_loop.defer([peer, alive]() {
+        if (!alive.expired()) peer->deliver();
+    });
+    return true;
+}
+
+size_t MemoryLink::getQueuedBytes() const
+{
+    return m_peer ? m_peer->m_inbox.size() : 0;
+}
+
+void MemoryLink::deliver()
+{
+    m_deliveryQueued = false;
+
+    string inbox;
+    inbox.swap(m_inbox);
+
+    // Data goes through frame decoder like a stream, after decoder error
+    // the rest is dropped with restart
+    size_t offset = 0;
+    while (offset < inbox.size() && m_port.isConnected() &&
+           !m_port.hasReceiveError()) {
+        size_t space;
+        char *buffer = m_port.getReceiveBuffer(space);
+        if (!space) break;
+        size_t size = min(space, inbox.size() - offset);
+        memcpy(buffer, inbox.data() + offset, size);
+        offset += size;
+        m_port.received(buffer, size);
+    }
+
+    // Sender's queue is empty now
+    if (m_peer) m_peer->m_port.updateCongestion();
+}
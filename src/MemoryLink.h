@@ -0,0 +1,53 @@
+#ifndef MEMORY_LINK_H
+#define MEMORY_LINK_H
+#include "Link.h"
+#include "EventLoop.h"
+#include <memory>
+#include <string>
+
+// Link between nodes of the same process sharing one event loop. Server
+// links are found by port number, data is appended to peer's inbox and
+// delivered after current batch of events, so nodes never call each other
+// recursively.
+class MemoryLink : public Link
+{
+public:
+    MemoryLink(Port &port);
+    ~MemoryLink();
+
+    void open();
+    void close();
+    bool isListening() const {
+        return m_address != 0;
+    }
+
+    bool send(const char *msg, size_t size);
+    size_t getQueuedBytes() const;
+
+private:
+
+    bool listen();
+    void connect();
+    bool accept(MemoryLink *client);
+    void pair(MemoryLink *peer);
+    void hangUp();
+    void deliver();
+
+    EventLoop &m_loop;
+
+    // Port number of listening link
+    unsigned m_address;
+    bool m_accepting;
+
+    MemoryLink *m_peer;
+    bool m_hungUp;
+
+    // Received data waiting for delivery
+    std::string m_inbox;
+    bool m_deliveryQueued;
+
+    // Deferred tasks check link still exists
+    std::shared_ptr<bool> m_alive;
+};
+
+#endif //MEMORY_LINK_H
@@ -1,6 +1,12 @@
 #include "Node.h"
 using namespace std;
 
+Node::~Node()
+{
+    for(auto &port : m_ports)
+        delete port.second;
+}
+
 bool Node::addPort(Port *port)
 {
     auto it = m_ports.find(port->getID());
@@ -21,8 +27,6 @@ bool Node::removePort(Port *port)
     auto it = m_ports.find(port->getID()); 
     if (it != m_ports.end()) {
         m_ports.erase(it);
-        port->kill();
-        port->join();
         delete port;
         return true;
     }
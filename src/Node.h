@@ -1,6 +1,7 @@
 #ifndef NODE_H
 #define NODE_H
 #include "Display.h"
+#include "EventLoop.h"
 #include "Port.h"
 #include <string>
 #include <map>
@@ -9,26 +10,52 @@ class Node
 {
 public:
 
-    Node(unsigned id, Display &display) : m_id(id), m_display(display) {}
-    virtual ~Node() {}
+    Node(unsigned id, Display &display, EventLoop &loop)
+        : m_id(id), m_display(display), m_loop(loop),
+          m_transport(Port::Transport::TCP) {}
+    virtual ~Node();
 
     virtual void handleCommand(const std::string &command) = 0;
 
     virtual bool addPort(Port *port);
     virtual bool removePort(Port *port);
 
+    // Ports of accepted peers get ids from their own range, so they never
+    // take id of a port created later by a command (bridge port ids are
+    // ids of neighbour bridges)
+    static const unsigned PEER_PORT_ID_BASE = 1000000;
+    unsigned getFreePeerPortID() const {
+        if (m_ports.empty() || m_ports.rbegin()->first < PEER_PORT_ID_BASE)
+            return PEER_PORT_ID_BASE;
+        return m_ports.rbegin()->first + 1;
+    }
+
     Display& getDisplay() {
         return m_display;
     }
+
+    EventLoop& getLoop() {
+        return m_loop;
+    }
     
     unsigned getID() const {
         return m_id;
     }
 
+    // Transport of ports created without explicit one
+    void setTransport(Port::Transport transport) {
+        m_transport = transport;
+    }
+    Port::Transport getTransport() const {
+        return m_transport;
+    }
+
 protected:
 
     unsigned m_id;
     Display &m_display;
+    EventLoop &m_loop;
+    Port::Transport m_transport;
     std::map<unsigned, Port*> m_ports;
 };
 
@@ -1,18 +1,23 @@
 #include "Port.h"
 #include "Node.h"
-#include <sys/socket.h>
-#include <sys/signalfd.h>
+#include "MemoryLink.h"
+#include "ShmLink.h"
+#include "TcpLink.h"
+#include "UdpLink.h"
 #include <cstring>
-#include <unistd.h>
 #include <ncurses.h>
 
 using namespace std;
 
-Port::Port(Node &node, unsigned id, ConnectionType connType) 
-    : m_node(node), m_id(id), m_connType(connType), m_thread(0), m_sigFD(0), 
-      m_kill(false), m_close(false), m_timeout(1), m_socket(0), 
-      m_clientSocket(0), m_port(0), m_clientPort(0), 
-      m_displayInfo(node.getDisplay()), m_connected(false)
+Port::Port(Node &node, unsigned id, ConnectionType connType,
+           const std::string &syncBytes)
+    : m_node(node), m_loop(node.getLoop()), m_id(id), m_connType(connType),
+      m_transport(node.getTransport()), m_link(nullptr), m_reopenTimer(0),
+      m_attempts(0), m_retryLimit(0), m_minBackoff(500), m_maxBackoff(30000),
+      m_random(random_device()()), m_peer(false), m_port(0), m_clientPort(0),
+      m_displayInfo(node.getDisplay()), m_connected(false),
+      m_decoder(syncBytes, 10), m_version(1), m_lowWatermark(16 * 1024),
+      m_highWatermark(64 * 1024), m_sendLimit(1024 * 1024), m_congested(false)
 {
     m_displayInfo.setID(to_string(id));
     m_displayInfo.setAddress("?");
@@ -25,82 +30,134 @@ Port::Port(Node &node, unsigned id, ConnectionType connType)
 
 Port::~Port()
 {
+    m_loop.cancelTimer(m_reopenTimer);
+    delete m_link;
 
+    m_node.getDisplay().rmConnection(&m_displayInfo);
+}
+
+void Port::setTransport(const std::string &name)
+{
+    if (name == "udp")
+        m_transport = Transport::UDP;
+    else if (name == "shm")
+        m_transport = Transport::SHM;
+    else
+        m_transport = Transport::TCP;
 }
 
 void Port::start()
 {
-    void *port = this;
-    pthread_create(&m_thread, nullptr, &Port::threadStart, port);
+    // Add port to UI
+    m_node.getDisplay().addConnection(&m_displayInfo);
+    m_node.getDisplay().queueUpdate();
+
+    // Peer ports get already connected link
+    if (!m_link) {
+        if (m_transport == Transport::UDP)
+            m_link = new UdpLink(*this);
+        else if (m_transport == Transport::SHM)
+            m_link = new ShmLink(*this);
+        else if (m_transport == Transport::MEMORY)
+            m_link = new MemoryLink(*this);
+        else
+            m_link = new TcpLink(*this);
+    }
+    m_link->open();
 }
 
-void* Port::threadStart(void *port)
+void Port::kill()
 {
-    Port *p = reinterpret_cast<Port*>(port);
-    p->run();
-    return nullptr;
+    m_loop.cancelTimer(m_reopenTimer);
+    m_reopenTimer = 0;
+    if (m_link) cleanup();
+
+    // Remove port from UI
+    m_node.getDisplay().rmConnection(&m_displayInfo);
+    m_node.getDisplay().queueUpdate();
+
+    // Destroy port
+    m_node.removePort(this);
 }
 
-void Port::run()
+void Port::close(unsigned int seconds)
 {
-    m_kill = false;
-    string err;
-
-    // Setup signal for receiving close and kill commands from console
-    sigset_t sigset;
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGUSR1);
-
-    m_sigFD = signalfd(-1, &sigset, 0);
-    if (m_sigFD == -1) {
-        unixError("Signal fd error");
-        m_node.removePort(this);
+    // Accepted connection cannot be reopened
+    if (m_peer) {
+        kill();
         return;
     }
 
-    // Add port to UI
-    m_node.getDisplay().addConnection(&m_displayInfo);
-    m_node.getDisplay().queueUpdate();
+    m_attempts = 0;
+    reopen(seconds * 1000);
+}
 
-    while(!m_kill) {
-        initialize();
-        mainLoop();
-        cleanup();
+void Port::restart()
+{
+    if (m_peer) {
+        kill();
+        return;
+    }
 
-        // 10 sec timeout interrupted by SIGUSR1
-        if(m_close && !m_kill) {
-            fd_set readSet;
-            FD_ZERO(&readSet);
-            FD_SET(m_sigFD, &readSet);
-
-            timeval tm;
-            tm.tv_sec = m_timeout;
-            tm.tv_usec = 0;
-
-            int result = select(m_sigFD + 1, &readSet, nullptr, nullptr, &tm);
-            
-            if (result == -1) {
-                unixError("Select error");
-                return;
-            }
-
-            if (FD_ISSET(m_sigFD, &readSet)) {
-                signalfd_siginfo si;
-                if (read(m_sigFD, &si, sizeof(si)) != sizeof(si)) {
-                    unixError("Signal read error");
-                    return;
-                }
-            }
-            m_timeout = 1;
+    // Server ports wait for next peer on still bound link (or bind
+    // again), client ports back off between attempts
+    if (m_connType == ConnectionType::SERVER) {
+        if (m_link->isListening()) {
+            cleanup();
+            m_link->open();
+        } else {
+            reopen(1000);
         }
+        return;
     }
 
-    // Remove port from UI
-    m_node.getDisplay().rmConnection(&m_displayInfo);
-    m_node.getDisplay().queueUpdate();
+    ++m_attempts;
+    if (m_retryLimit && m_attempts > m_retryLimit) {
+        m_loop.cancelTimer(m_reopenTimer);
+        m_reopenTimer = 0;
+        cleanup();
 
-    // Destroy port
-    m_node.removePort(this);
+        string msg = "Giving up after ";
+        msg += to_string(m_attempts);
+        msg += " attempts";
+        portMsg(msg);
+        return;
+    }
+
+    reopen(backoff());
+}
+
+void Port::restartLater()
+{
+    if (m_reopenTimer) return;
+    m_reopenTimer = m_loop.setTimer(0, [this]() {
+        m_reopenTimer = 0;
+        restart();
+    });
+}
+
+void Port::reopen(unsigned milliseconds)
+{
+    cleanup();
+
+    // Reopen port after timeout
+    m_loop.cancelTimer(m_reopenTimer);
+    m_reopenTimer = m_loop.setTimer(milliseconds, [this]() {
+        m_reopenTimer = 0;
+        m_link->open();
+    });
+}
+
+unsigned Port::backoff()
+{
+    // Exponential delay with jitter, so restarted neighbours don't retry
+    // at the same moment
+    unsigned delay = m_maxBackoff;
+    if (m_attempts <= 16 && (m_minBackoff << (m_attempts - 1)) < delay)
+        delay = m_minBackoff << (m_attempts - 1);
+
+    uniform_int_distribution<unsigned> jitter(delay / 2, delay);
+    return jitter(m_random);
 }
 
 void Port::portMsg(const std::string &msg) {
@@ -125,229 +182,166 @@ void Port::unixError(const std::string &msg) {
     m += ": ";
     m += strerror(errno);
     portMsg(m);
-    m_close = true;
 }
 
-void Port::initialize()
+void Port::updateAddress(const std::string &ip, unsigned port)
 {
-    // Mark as not closed
-    m_close = false;
-
-    // Create socket
-    m_socket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_IP);
-    if (m_socket == -1) {
-        unixError("Cannot create a socket");
-        return;
-    }
-
-    // Construct local address structure
-    memset(&m_addr, 0, sizeof(m_addr));
-    m_addr.sin_family = AF_INET;
-    m_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    m_addr.sin_port = htons(m_port);
+    m_IP = ip;
+    m_port = port;
+    m_displayInfo.setPort(to_string(m_port));
+    m_displayInfo.setAddress(m_IP);
+    m_node.getDisplay().queueUpdate();
+}
 
-    // Bind it to local address and port
-    if (bind(m_socket, reinterpret_cast<sockaddr*>(&m_addr),
-             sizeof(m_addr)) == -1) {
-        unixError("Cannot bind a socket");
-        return;
-    }
+void Port::updateClientAddress(const std::string &ip, unsigned port)
+{
+    m_clientIP = ip;
+    m_clientPort = port;
+    m_displayInfo.setClientPort(to_string(m_clientPort));
+    m_displayInfo.setClientAddress(m_clientIP);
+    m_node.getDisplay().queueUpdate();
+}
 
-    socklen_t len = sizeof(m_addr);
-    if (getsockname(m_socket, 
-                    reinterpret_cast<sockaddr*>(&m_addr), &len) == -1) {
-        unixError("Cannot get socket name");
-        return;
-    }
+Port* Port::createPeerPort()
+{
+    Port *peer = createPeer(m_node.getFreePeerPortID());
+    if (!peer) return nullptr;
 
-    // Update IP/Port values
-    m_port = ntohs(m_addr.sin_port);
-    m_IP = inet_ntoa(m_addr.sin_addr);
+    peer->m_peer = true;
+    peer->m_transport = m_transport;
+    peer->updateAddress(m_IP, m_port);
+    return peer;
+}
 
-    // Depends on type do listening or connection
-    if (m_connType == ConnectionType::SERVER) {
-        if (listen(m_socket, 1) == -1) {
-            unixError("Listen error");
-            return;
-        }
-        m_clientIP = inet_ntoa(m_clientAddr.sin_addr);
-        m_clientPort = ntohs(m_clientAddr.sin_port);
-    } else {
-        // Setup address for connection
-        memset(&m_clientAddr, 0, sizeof(m_clientAddr));
-        m_clientAddr.sin_family = AF_INET;
-        m_clientAddr.sin_addr.s_addr = inet_addr(m_clientIP.c_str());
-        m_clientAddr.sin_port = htons(m_clientPort);
-
-        // Update information
-        m_displayInfo.setClientPort(to_string(m_clientPort));
-        m_displayInfo.setClientAddress(m_clientIP);
-    }
+bool Port::addPeerPort(Port *peer, Link *link)
+{
+    peer->m_link = link;
+    return m_node.addPort(peer);
+}
 
-    // Update information
-    m_displayInfo.setPort(to_string(m_port));
-    m_displayInfo.setAddress(m_IP);
-    m_node.getDisplay().queueUpdate();
+void Port::established()
+{
+    m_attempts = 0;
+    m_connected = true;
+    markClosed();
 
-    // Do listening/connect on select
-    while(true) {
-        int result;
-       
-        if (m_connType == ConnectionType::SERVER)
-            result = accept(m_socket, 
-                            reinterpret_cast<sockaddr*>(&m_clientAddr),
-                            &len);
-        else
-            result = connect(m_socket, 
-                             reinterpret_cast<const sockaddr*>(&m_clientAddr),
-                             sizeof(m_clientAddr));
-
-        // Check value
-        if (m_connType == ConnectionType::SERVER) {
-            if (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-                unixError("Accept error");
-                return;
-            }
-            if (result >= 0) {
-                // Close server socket and use connected socket
-                ::close(m_socket);
-                m_socket = result;
-
-                // Get peer address and update UI
-                m_clientPort = ntohs(m_clientAddr.sin_port);
-                m_clientIP = inet_ntoa(m_clientAddr.sin_addr);
-                m_displayInfo.setClientPort(to_string(m_clientPort));
-                m_displayInfo.setClientAddress(m_clientIP);
-                m_node.getDisplay().queueUpdate();
-
-                break;
-            }
-        } else {
-            if (result == -1 && errno != EINPROGRESS && errno != EALREADY) {
-                unixError("Connection error");
-                return;
-            }
-            if (result == 0) break;
-        }
+    // Offer version 2 before any other frame, old peers ignore it
+    const char hello[] = {FRAME_HELLO, static_cast<char>(FRAME_VERSION)};
+    m_version = 1;
+    FrameDecoder::encode(hello, sizeof(hello), m_sendBuffer);
+    m_link->send(m_sendBuffer.data(), m_sendBuffer.size());
 
-        // Do select
-        fd_set readSet;
-        FD_ZERO(&readSet);
-        FD_SET(m_socket, &readSet);
-        FD_SET(m_sigFD, &readSet);
-
-        fd_set writeSet;
-        FD_ZERO(&writeSet);
-        FD_SET(m_socket, &writeSet);
-        FD_SET(m_sigFD, &writeSet);
-
-        result = select((m_socket > m_sigFD ? m_socket : m_sigFD) + 1,
-                        &readSet, &writeSet, nullptr, nullptr);
-        
-        if (result == -1) {
-            unixError("Select error");
-            return;
-        }
+    connected();
+}
 
-        if (FD_ISSET(m_sigFD, &readSet)) {
-            signalfd_siginfo si;
-            if (read(m_sigFD, &si, sizeof(si)) != sizeof(si)) {
-                unixError("Signal read error");
-                return;
-            }
-            unixError("Not expected");
-            break;
-        }
-    }
+void Port::gotHello(const Frame &frame)
+{
+    unsigned version = frame.size > 1 ? (unsigned char)frame.data[1] : 1;
+    version = min<unsigned>(version, FRAME_VERSION);
+    if (version == m_version) return;
+    m_version = version;
+
+    MsgInfo info;
+    info.header = "Protocol v";
+    info.header += to_string(m_version);
+    m_displayInfo.addMsg(info);
+    m_node.getDisplay().queueUpdate();
 
-    // If not closed, port has been connected
-    if (!m_close && !m_kill) {
-        m_connected = true;
-        markClosed();
-        connected();
-    }
+    upgraded();
 }
 
 void Port::cleanup()
 {
-    if(m_socket) {
-        shutdown(m_socket, SHUT_RDWR);
-        ::close(m_socket);
-        m_socket = 0;
-    }
+    m_link->close();
 
-    if(m_clientSocket) {
-        shutdown(m_clientSocket, SHUT_RDWR);
-        ::close(m_clientSocket);
-        m_clientSocket = 0;
-    }
+    // Drop partially received messages
+    m_decoder.clear();
+    m_congested = false;
 
     // Port has been disconnected
+    bool wasConnected = m_connected;
     m_connected = false;
     m_displayInfo.setStatus(ConnectionInfo::Status::NOT_CONNECTED);
     m_node.getDisplay().queueUpdate();
-    disconnected();
+    if (wasConnected) disconnected();
 }
 
-void Port::mainLoop()
+void Port::received(const char *data, size_t size)
 {
-    while(!m_close && !m_kill) {
-        fd_set set;
-        FD_ZERO(&set);
-        FD_SET(m_socket, &set);
-        FD_SET(m_sigFD, &set);
-        int result = select((m_socket > m_sigFD ? m_socket : m_sigFD) + 1,
-                            &set, nullptr, nullptr, nullptr);
-        
-        if (result == -1) {
-            unixError("Select error");
-            return;
-        }
-
-        // Handle signal
-        if (FD_ISSET(m_sigFD, &set)) {
-            signalfd_siginfo si;
-            if (read(m_sigFD, &si, sizeof(si)) != sizeof(si)) {
-                unixError("Signal read error");
-                return;
-            }
-            break;
-        }
+    m_decoder.commit(size);
+    gotMsg(data, size);
+
+    // Handlers can close port, which drops buffered data
+    Frame frame;
+    while (m_connected && m_decoder.next(frame)) {
+        if (*frame.data == FRAME_HELLO)
+            gotHello(frame);
+        else
+            gotFrame(frame);
+    }
 
-        // Handle message
-        if (FD_ISSET(m_socket, &set)) {
-            char buffer[256];
-            ssize_t size = recv(m_socket, buffer, 255, 0);
-            
-            if (size == -1) {
-                unixError("Socket read error");
-                return;
-            }
-
-            if (size == 0) {
-                m_close = true;
-                return;
-            }
-
-            string msg;
-            msg.assign(buffer, size);
-            gotMsg(msg); 
-        }
+    // Restart can destroy port, so do it outside of link callback
+    if (m_connected && m_decoder.hasError() && !m_reopenTimer) {
+        portMsg("Protocol error");
+        restartLater();
     }
 }
 
-void Port::sendMessage(const string &msg, bool force)
+void Port::receivedFrame(const char *data, size_t size)
 {
-    // If connected and opened
+    // Datagrams keep frame boundaries, so there is nothing to resync
+    Frame frame;
+    if (!m_decoder.parse(data, size, frame)) return;
+
+    gotMsg(data, size);
     if (!m_connected) return;
 
+    if (*frame.data == FRAME_HELLO)
+        gotHello(frame);
+    else
+        gotFrame(frame);
+}
+
+bool Port::sendMessage(const char *msg, size_t size, bool force)
+{
+    // If connected and opened
+    if (!m_connected) return false;
+
     // If not forced and not opened, abort.
     if (!force && m_displayInfo.getStatus() != ConnectionInfo::Status::OPENED)
-        return;
+        return false;
+
+    // Slow peer, drop data and let only forced messages through
+    if (!force && m_congested) return false;
+
+    // Only version 2 frames have length
+    if (m_version < 2 && size != 10) return false;
+
+    if (m_version >= 2) {
+        FrameDecoder::encode(msg, size, m_sendBuffer);
+        msg = m_sendBuffer.data();
+        size = m_sendBuffer.size();
+    }
 
-    ssize_t size = send(m_socket, msg.c_str(), msg.length(), MSG_NOSIGNAL);
-    if (size == -1) unixError("Send error");
-    if (size != msg.length()) unixError("Didn't send full message");
+    if (getQueuedBytes() + size > m_sendLimit) {
+        portMsg("Send queue overflow");
+        return false;
+    }
+
+    if (!m_link->send(msg, size)) return false;
+    updateCongestion();
+    return true;
+}
+
+void Port::updateCongestion()
+{
+    size_t queued = getQueuedBytes();
+    if (!m_congested && queued >= m_highWatermark)
+        m_congested = true;
+    else if (m_congested && queued <= m_lowWatermark) {
+        m_congested = false;
+        drained();
+    }
 }
 
 void Port::markOpened() {
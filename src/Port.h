@@ -1,8 +1,11 @@
 #ifndef PORT_H
 #define PORT_H
 #include "Display.h"
+#include "EventLoop.h"
+#include "FrameDecoder.h"
+#include "Link.h"
 #include <arpa/inet.h>
-#include <pthread.h>
+#include <random>
 
 class Node;
 
@@ -14,25 +17,22 @@ public:
         CLIENT
     };
 
-    Port(Node &node, unsigned id, ConnectionType connType);
+    enum class Transport {
+        TCP,
+        UDP,
+        SHM,
+        MEMORY
+    };
+
+    // Received stream is split into frames starting with one of sync bytes
+    Port(Node &node, unsigned id, ConnectionType connType,
+         const std::string &syncBytes);
     virtual ~Port();
 
+    // Port lifetime functions, called from node's event loop thread
     void start();
-
-    void join() {
-        pthread_join(m_thread, nullptr);
-    }
-
-    void kill() {
-        m_kill = true;
-        pthread_kill(m_thread, SIGUSR1);
-    }
-
-    void close(unsigned int seconds) {
-        m_close = true;
-        m_timeout = seconds;
-        pthread_kill(m_thread, SIGUSR1);
-    }
+    void kill();
+    void close(unsigned int seconds);
 
     int getID() const {
         return m_id;
@@ -48,17 +48,55 @@ public:
         m_clientPort = port;
     }
 
+    // Number of reconnections of client port, 0 means no limit
+    void setRetryLimit(unsigned limit) {
+        m_retryLimit = limit;
+    }
+
+    // Transport used by link created on start
+    void setTransport(Transport transport) {
+        m_transport = transport;
+    }
+    void setTransport(const std::string &name);
+
     // Mark socket as open
     void markOpened();
 
     // Mark socket as closed
     void markClosed();
 
-    // Queue message to be send by this port
-    void sendMessage(const std::string &msg, bool force);
+    bool isOpened() const {
+        return m_displayInfo.getStatus() == ConnectionInfo::Status::OPENED;
+    }
+
+    // Queue message to be send by this port. Never blocks, returns false
+    // if message has been dropped. Message is a frame starting with type
+    // byte, it is encoded in protocol version negotiated with peer.
+    bool sendMessage(const char *msg, size_t size, bool force);
+    bool sendMessage(const std::string &msg, bool force) {
+        return sendMessage(msg.data(), msg.size(), force);
+    }
+
+    // Outbound queue limits (in bytes). Port becomes congested above high
+    // watermark and accepts only forced messages until queue drops below
+    // low watermark. Queue never grows above limit.
+    void setWatermarks(size_t low, size_t high, size_t limit) {
+        m_lowWatermark = low;
+        m_highWatermark = high;
+        m_sendLimit = limit;
+    }
+    bool isCongested() const {
+        return m_congested;
+    }
+    size_t getQueuedBytes() const {
+        return m_link ? m_link->getQueuedBytes() : 0;
+    }
+
+    // Raw data received by port
+    virtual void gotMsg(const char *, size_t) {}
 
-    // Handle this function to process data
-    virtual void gotMsg(const std::string &) {}
+    // Handle this function to process frames
+    virtual void gotFrame(const Frame &) {}
 
     // Port has been connected
     virtual void connected() {}
@@ -66,31 +104,98 @@ public:
     // Port had been disconnected
     virtual void disconnected() {}
 
-protected:
+    // Outbound queue dropped below low watermark after congestion
+    virtual void drained() {}
+
+    // Peer switched protocol version, see getVersion()
+    virtual void upgraded() {}
+
+    // Create port for additional peer accepted by server port. Returning
+    // nullptr rejects the peer.
+    virtual Port* createPeer(unsigned) {
+        return nullptr;
+    }
+
+    // Link callbacks, called from event loop thread
+    EventLoop& getLoop() {
+        return m_loop;
+    }
+    ConnectionType getConnectionType() const {
+        return m_connType;
+    }
+    unsigned getPort() const {
+        return m_port;
+    }
+    const std::string& getClientIP() const {
+        return m_clientIP;
+    }
+    unsigned getClientPort() const {
+        return m_clientPort;
+    }
+    bool isConnected() const {
+        return m_connected;
+    }
+    void updateAddress(const std::string &ip, unsigned port);
+    void updateClientAddress(const std::string &ip, unsigned port);
+
+    // Stream data is received directly into frame decoder buffer. Decoder
+    // with error takes no more data until port is restarted.
+    char* getReceiveBuffer(size_t &space) {
+        return m_decoder.getWriteBuffer(space);
+    }
+    bool hasReceiveError() const {
+        return m_decoder.hasError();
+    }
+    void received(const char *data, size_t size);
+
+    // Datagram carrying exactly one frame
+    void receivedFrame(const char *data, size_t size);
+
+    // Protocol version used for sending, peers start with version 1 and
+    // switch to version 2 after hello frame of the other side
+    unsigned getVersion() const {
+        return m_version;
+    }
+
+    void established();
+    void restart();
+    // Restart from event loop, when caller cannot let port be destroyed
+    void restartLater();
+    void updateCongestion();
+
+    // Additional peer of server link. Peer port is started with given link
+    // (which is already connected) by addPeerPort().
+    Port* createPeerPort();
+    bool addPeerPort(Port *peer, Link *link);
 
-    static void* threadStart(void *port);
-    void run();
-    void initialize();
-    void cleanup();
-    void mainLoop();
     void portMsg(const std::string &msg);
     void unixError(const std::string &msg);
 
+protected:
+
+    // Connection state machine driven by event loop
+    void cleanup();
+    void reopen(unsigned milliseconds);
+    void gotHello(const Frame &frame);
+    unsigned backoff();
+
     Node &m_node;
+    EventLoop &m_loop;
     unsigned m_id;
     ConnectionType m_connType;
+    Transport m_transport;
+    Link *m_link;
 
-    pthread_t m_thread;
-    int m_sigFD;
-    bool m_kill;
-    bool m_close;
-    unsigned m_timeout;
-
-    int m_socket;
-    int m_clientSocket;
+    // Reconnection with backoff (in milliseconds)
+    EventLoop::TimerID m_reopenTimer;
+    unsigned m_attempts;
+    unsigned m_retryLimit;
+    unsigned m_minBackoff;
+    unsigned m_maxBackoff;
+    std::minstd_rand m_random;
 
-    sockaddr_in m_addr;
-    sockaddr_in m_clientAddr;
+    // Accepted by another server port, closed for good on disconnect
+    bool m_peer;
 
     std::string m_IP;
     std::string m_clientIP;
@@ -100,6 +205,16 @@ protected:
 
     ConnectionInfo m_displayInfo;
     bool m_connected;
+
+    FrameDecoder m_decoder;
+    unsigned m_version;
+    std::string m_sendBuffer;
+
+    // Outbound queue limits, queue itself is kept by link
+    size_t m_lowWatermark;
+    size_t m_highWatermark;
+    size_t m_sendLimit;
+    bool m_congested;
 };
 
 #endif //PORT_H
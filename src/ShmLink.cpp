@@ -0,0 +1,528 @@
+#include "ShmLink.h"
+#include "Port.h"
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <unistd.h>
+using namespace std;
+
+// Bytes in each direction, power of two
+static const size_t RING_SIZE = 64 * 1024;
+
+// Producer and consumer positions only grow and are kept in separate
+// cache lines
+struct ShmRing {
+    uint64_t head;
+    char headPad[56];
+    uint64_t tail;
+    char tailPad[56];
+    uint32_t waiting;
+    char waitingPad[60];
+    char data[RING_SIZE];
+};
+
+// First ring carries data from client to server, second one back
+static const size_t MEMORY_SIZE = 2 * sizeof(ShmRing);
+
+// Abstract unix socket name, doesn't leave files behind
+static socklen_t controlAddress(unsigned port, sockaddr_un &addr)
+{
+    string name("stp-shm-");
+    name += to_string(port);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, name.data(), name.size());
+    return offsetof(sockaddr_un, sun_path) + 1 + name.size();
+}
+
+ShmLink::ShmLink(Port &port)
+    : Link(port), m_loop(port.getLoop()), m_listenSocket(0), m_socket(0),
+      m_waitFD(0), m_notifyFD(0), m_notifyQueued(false),
+      m_alive(make_shared<bool>(true)), m_memory(nullptr), m_rx(nullptr),
+      m_tx(nullptr), m_established(false), m_sendQueued(0)
+{
+
+}
+
+ShmLink::~ShmLink()
+{
+    close();
+    closeListener();
+}
+
+void ShmLink::open()
+{
+    // Peer accepted by other link waits for memory
+    if (m_socket) {
+        if (!m_loop.add(m_socket, EPOLLIN,
+                        [this](uint32_t) { handleControl(); })) {
+            m_port.unixError("Event loop error");
+            m_port.restart();
+        }
+        return;
+    }
+
+    // Listening socket is already bound, wait for peers again
+    if (m_listenSocket) {
+        if (!m_loop.add(m_listenSocket, EPOLLIN,
+                        [this](uint32_t) { acceptConnection(); })) {
+            m_port.unixError("Event loop error");
+            closeListener();
+            m_port.restart();
+        }
+        return;
+    }
+
+    bool result;
+    if (m_port.getConnectionType() == Port::ConnectionType::SERVER)
+        result = listen();
+    else
+        result = connect();
+
+    if (!result) m_port.restart();
+}
+
+void ShmLink::close()
+{
+    if (m_socket) {
+        m_loop.remove(m_socket);
+        ::close(m_socket);
+        m_socket = 0;
+    }
+
+    // Listening socket stays bound, new peers wait in backlog
+    if (m_listenSocket) m_loop.remove(m_listenSocket);
+
+    if (m_waitFD) {
+        m_loop.remove(m_waitFD);
+        ::close(m_waitFD);
+        m_waitFD = 0;
+    }
+
+    if (m_notifyFD) {
+        ::close(m_notifyFD);
+        m_notifyFD = 0;
+    }
+
+    if (m_memory) {
+        munmap(m_memory, MEMORY_SIZE);
+        m_memory = nullptr;
+        m_rx = m_tx = nullptr;
+    }
+
+    // Drop pending messages
+    m_established = false;
+    m_sendQueue.clear();
+    m_sendQueued = 0;
+}
+
+bool ShmLink::listen()
+{
+    m_listenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+                            SOCK_CLOEXEC, 0);
+    if (m_listenSocket == -1) {
+        m_listenSocket = 0;
+        m_port.unixError("Cannot create a socket");
+        return false;
+    }
+
+    // Without port number take first free one from dynamic range
+    unsigned port = m_port.getPort();
+    unsigned last = port ? port : 65535;
+    if (!port) port = 49152;
+
+    sockaddr_un addr;
+    while (true) {
+        socklen_t len = controlAddress(port, addr);
+        if (bind(m_listenSocket, reinterpret_cast<sockaddr*>(&addr),
+                 len) == 0)
+            break;
+
+        if (port == last) {
+            m_port.unixError("Cannot bind a socket");
+            closeListener();
+            return false;
+        }
+        ++port;
+    }
+
+    // Update information
+    m_port.updateAddress("shm", port);
+
+    if (::listen(m_listenSocket, SOMAXCONN) == -1) {
+        m_port.unixError("Listen error");
+        closeListener();
+        return false;
+    }
+
+    // Wait for incoming connections
+    if (!m_loop.add(m_listenSocket, EPOLLIN,
+                    [this](uint32_t) { acceptConnection(); })) {
+        m_port.unixError("Event loop error");
+        closeListener();
+        return false;
+    }
+
+    return true;
+}
+
+bool ShmLink::connect()
+{
+    m_port.updateAddress("shm", m_port.getPort());
+    m_port.updateClientAddress("shm", m_port.getClientPort());
+
+    m_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                      0);
+    if (m_socket == -1) {
+        m_socket = 0;
+        m_port.unixError("Cannot create a socket");
+        return false;
+    }
+
+    // Local connection is finished at once
+    sockaddr_un addr;
+    socklen_t len = controlAddress(m_port.getClientPort(), addr);
+    if (::connect(m_socket, reinterpret_cast<sockaddr*>(&addr), len) == -1) {
+        m_port.unixError("Connection error");
+        return false;
+    }
+
+    if (!createMemory()) {
+        m_port.unixError("Shared memory error");
+        return false;
+    }
+
+    // Control socket only reports peer exit
+    if (!m_loop.add(m_socket, EPOLLIN,
+                    [this](uint32_t) { handleControl(); })) {
+        m_port.unixError("Event loop error");
+        return false;
+    }
+
+    established();
+    return true;
+}
+
+void ShmLink::acceptConnection()
+{
+    // Accept all pending peers
+    while (m_listenSocket) {
+        int result = accept4(m_listenSocket, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (result == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            m_port.unixError("Accept error");
+            closeListener();
+            m_port.restart();
+            return;
+        }
+
+        // First peer is handled by this port
+        if (!m_socket) {
+            adopt(result);
+            open();
+            continue;
+        }
+
+        // Other peers get their own logical ports
+        Port *peer = m_port.createPeerPort();
+        if (!peer) {
+            ::close(result);
+            m_port.portMsg("Peer rejected, port is already connected");
+            continue;
+        }
+
+        ShmLink *link = new ShmLink(*peer);
+        link->adopt(result);
+        m_port.addPeerPort(peer, link);
+    }
+}
+
+void ShmLink::adopt(int socket)
+{
+    m_socket = socket;
+
+    // Peer has no port number, show its process id instead
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(m_socket, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+        m_port.updateClientAddress("pid", cred.pid);
+}
+
+void ShmLink::closeListener()
+{
+    if (m_listenSocket) {
+        m_loop.remove(m_listenSocket);
+        ::close(m_listenSocket);
+        m_listenSocket = 0;
+    }
+}
+
+void ShmLink::handleControl()
+{
+    // First message of client carries memory and eventfds
+    if (!m_established) {
+        if (!receiveMemory()) {
+            m_port.unixError("Shared memory error");
+            m_port.restart();
+        }
+        return;
+    }
+
+    // Nothing else is sent, so it is hang up
+    char buffer[16];
+    ssize_t size = recv(m_socket, buffer, sizeof(buffer), 0);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (size == -1) m_port.unixError("Socket read error");
+    if (size <= 0) m_port.restart();
+}
+
+bool ShmLink::createMemory()
+{
+    int memFD = memfd_create("stp-shm", MFD_CLOEXEC);
+    if (memFD == -1) return false;
+
+    int fds[3] = {memFD, -1, -1};
+    bool result = ftruncate(memFD, MEMORY_SIZE) == 0;
+    if (result) {
+        fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        result = fds[1] != -1 && fds[2] != -1 && mapMemory(memFD, false);
+    }
+
+    // Pass descriptors to server
+    if (result) {
+        char data = 0;
+        iovec iov;
+        iov.iov_base = &data;
+        iov.iov_len = 1;
+
+        char control[CMSG_SPACE(sizeof(fds))];
+        memset(control, 0, sizeof(control));
+
+        msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        result = sendmsg(m_socket, &hdr, MSG_NOSIGNAL) == 1;
+    }
+
+    // Client waits on second eventfd and wakes server with first one
+    int error = errno;
+    ::close(memFD);
+    if (result) {
+        m_notifyFD = fds[1];
+        m_waitFD = fds[2];
+    } else {
+        if (fds[1] != -1) ::close(fds[1]);
+        if (fds[2] != -1) ::close(fds[2]);
+    }
+    errno = error;
+    return result;
+}
+
+bool ShmLink::receiveMemory()
+{
+    int fds[3];
+    char data;
+    iovec iov;
+    iov.iov_base = &data;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof(fds))];
+    msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    ssize_t size = recvmsg(m_socket, &hdr, MSG_CMSG_CLOEXEC);
+    if (size == -1) return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (size == 0) {
+        errno = ECONNRESET;
+        return false;
+    }
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        errno = EPROTO;
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // Server waits on first eventfd and wakes client with second one
+    m_waitFD = fds[1];
+    m_notifyFD = fds[2];
+    bool result = mapMemory(fds[0], true);
+    ::close(fds[0]);
+    if (!result) return false;
+
+    m_loop.remove(m_socket);
+    if (!m_loop.add(m_socket, EPOLLIN,
+                    [this](uint32_t) { handleControl(); }))
+        return false;
+
+    established();
+    return true;
+}
+
+bool ShmLink::mapMemory(int memFD, bool server)
+{
+    m_memory = mmap(nullptr, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    memFD, 0);
+    if (m_memory == MAP_FAILED) {
+        m_memory = nullptr;
+        return false;
+    }
+
+    ShmRing *rings = static_cast<ShmRing*>(m_memory);
+    m_rx = server ? &rings[0] : &rings[1];
+    m_tx = server ? &rings[1] : &rings[0];
+    return true;
+}
+
+void ShmLink::established()
+{
+    if (!m_loop.add(m_waitFD, EPOLLIN, [this](uint32_t) { wakeUp(); })) {
+        m_port.unixError("Event loop error");
+        m_port.restart();
+        return;
+    }
+
+    m_established = true;
+    m_port.established();
+
+    // Peer could write before we started waiting
+    readMessages();
+}
+
+void ShmLink::wakeUp()
+{
+    uint64_t value;
+    if (read(m_waitFD, &value, sizeof(value)) != sizeof(value)) {
+        // Counter was reset by previous wake up, rings are checked anyway
+    }
+
+    readMessages();
+    if (m_established) writeMessages();
+}
+
+void ShmLink::readMessages()
+{
+    bool freed = false;
+    uint64_t head = m_rx->head;
+    uint64_t tail = __atomic_load_n(&m_rx->tail, __ATOMIC_ACQUIRE);
+
+    // Handlers can close port, which unmaps memory. Corrupted stream is
+    // left in ring for restart, which runs from event loop.
+    while (head != tail && m_port.isConnected() &&
+           !m_port.hasReceiveError()) {
+        size_t space;
+        char *buffer = m_port.getReceiveBuffer(space);
+        if (!space) break;
+
+        // Copy up to end of ring, rest is read in next pass
+        size_t offset = head & (RING_SIZE - 1);
+        size_t size = min<size_t>(tail - head, RING_SIZE - offset);
+        size = min(size, space);
+        memcpy(buffer, m_rx->data + offset, size);
+
+        head += size;
+        __atomic_store_n(&m_rx->head, head, __ATOMIC_SEQ_CST);
+        freed = true;
+
+        m_port.received(buffer, size);
+        if (m_port.isConnected() && head == tail)
+            tail = __atomic_load_n(&m_rx->tail, __ATOMIC_ACQUIRE);
+    }
+
+    // Writer waits for free space
+    if (freed && m_rx && __atomic_exchange_n(&m_rx->waiting, 0,
+                                             __ATOMIC_SEQ_CST))
+        notify();
+}
+
+bool ShmLink::send(const char *msg, size_t size)
+{
+    if (!m_established) return false;
+
+    if (m_sendQueue.empty() && writeRing(msg, size)) return true;
+
+    // Ring is full, keep message until reader makes space
+    m_sendQueue.push_back(string(msg, size));
+    m_sendQueued += size;
+    writeMessages();
+    return true;
+}
+
+void ShmLink::writeMessages()
+{
+    while (!m_sendQueue.empty()) {
+        const string &msg = m_sendQueue.front();
+        if (!writeRing(msg.data(), msg.size())) {
+            // Ask reader to wake us up and check again, it could have
+            // read everything in the meantime
+            __atomic_store_n(&m_tx->waiting, 1, __ATOMIC_SEQ_CST);
+            if (!writeRing(msg.data(), msg.size())) break;
+        }
+        m_sendQueued -= msg.size();
+        m_sendQueue.pop_front();
+    }
+
+    m_port.updateCongestion();
+}
+
+bool ShmLink::writeRing(const char *msg, size_t size)
+{
+    uint64_t tail = m_tx->tail;
+    uint64_t head = __atomic_load_n(&m_tx->head, __ATOMIC_SEQ_CST);
+    if (RING_SIZE - (tail - head) < size) return false;
+
+    // Message can wrap around end of ring
+    size_t offset = tail & (RING_SIZE - 1);
+    size_t first = min(size, RING_SIZE - offset);
+    memcpy(m_tx->data + offset, msg, first);
+    memcpy(m_tx->data, msg + first, size - first);
+
+    __atomic_store_n(&m_tx->tail, tail + size, __ATOMIC_RELEASE);
+    notify();
+    return true;
+}
+
+void ShmLink::notify()
+{
+    // Wake peer once per batch of events
+    if (m_notifyQueued) return;
+    m_notifyQueued = true;
+
+    weak_ptr<bool> alive = m_alive;
+    m_loop.defer([this, alive]() {
+        if (alive.expired()) return;
+        m_notifyQueued = false;
+
+        uint64_t value = 1;
+        if (m_notifyFD &&
+            write(m_notifyFD, &value, sizeof(value)) != sizeof(value)) {
+            // Counter is already signaled, peer will check rings anyway
+        }
+    });
+}
@@ -0,0 +1,76 @@
+#ifndef SHM_LINK_H
+#define SHM_LINK_H
+#include "Link.h"
+#include "EventLoop.h"
+#include <deque>
+#include <memory>
+#include <string>
+
+struct ShmRing;
+
+// Link between nodes on the same host. Frames go through a pair of single
+// producer/single consumer rings in shared memory, peers wake each other
+// with eventfds. Client creates memory and eventfds and passes them over
+// unix socket named after server port number. The socket is kept open,
+// so peer exit is noticed as hang up.
+class ShmLink : public Link
+{
+public:
+    ShmLink(Port &port);
+    ~ShmLink();
+
+    void open();
+    void close();
+    bool isListening() const {
+        return m_listenSocket != 0;
+    }
+
+    bool send(const char *msg, size_t size);
+    size_t getQueuedBytes() const {
+        return m_sendQueued;
+    }
+
+    // Use control socket accepted by other link
+    void adopt(int socket);
+
+private:
+
+    bool listen();
+    bool connect();
+    void acceptConnection();
+    void closeListener();
+    void handleControl();
+    bool receiveMemory();
+    bool createMemory();
+    bool mapMemory(int memFD, bool server);
+    void established();
+    void wakeUp();
+    void readMessages();
+    void writeMessages();
+    bool writeRing(const char *msg, size_t size);
+    void notify();
+
+    EventLoop &m_loop;
+
+    int m_listenSocket;
+    int m_socket;
+
+    // Eventfds, first wakes us, second wakes peer
+    int m_waitFD;
+    int m_notifyFD;
+    bool m_notifyQueued;
+
+    // Deferred notification checks link still exists
+    std::shared_ptr<bool> m_alive;
+
+    void *m_memory;
+    ShmRing *m_rx;
+    ShmRing *m_tx;
+    bool m_established;
+
+    // Frames which didn't fit into ring
+    std::deque<std::string> m_sendQueue;
+    size_t m_sendQueued;
+};
+
+#endif //SHM_LINK_H
@@ -0,0 +1,471 @@
+#include "TcpLink.h"
+#include "Port.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <unistd.h>
+using namespace std;
+
+// Pending data is passed to kernel before the end of batch when it grows
+// this large, so sending loops cannot queue without limit
+static const size_t SUBMIT_SIZE = 256 * 1024;
+
+TcpLink::TcpLink(Port &port)
+    : Link(port), m_loop(port.getLoop()), m_listenSocket(0), m_socket(0),
+      m_sendOffset(0), m_sendQueued(0), m_sendOperation(0),
+      m_sendPending(0), m_submitQueued(false), m_alive(make_shared<bool>())
+{
+
+}
+
+TcpLink::~TcpLink()
+{
+    m_loop.cancelOperation(m_sendOperation);
+
+    if (m_socket) {
+        m_loop.remove(m_socket);
+        ::close(m_socket);
+    }
+    closeListener();
+}
+
+void TcpLink::open()
+{
+    // Peer accepted by other link is already connected
+    if (m_socket) {
+        established();
+        return;
+    }
+
+    // Listening socket is already bound, wait for peers again
+    if (m_listenSocket) {
+        if (!m_loop.add(m_listenSocket, EPOLLIN,
+                        [this](uint32_t) { acceptConnection(); })) {
+            m_port.unixError("Event loop error");
+            closeListener();
+            m_port.restart();
+        }
+        return;
+    }
+
+    // Create socket
+    m_socket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_IP);
+    if (m_socket == -1) {
+        m_socket = 0;
+        m_port.unixError("Cannot create a socket");
+        m_port.restart();
+        return;
+    }
+
+    // Construct local address structure
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(m_port.getPort());
+
+    bool server = m_port.getConnectionType() == Port::ConnectionType::SERVER;
+
+    // Listening port can be bound again while old connections linger
+    if (server) {
+        int reuse = 1;
+        setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+
+    // Bind it to local address and port
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&addr),
+             sizeof(addr)) == -1) {
+        m_port.unixError("Cannot bind a socket");
+        m_port.restart();
+        return;
+    }
+
+    socklen_t len = sizeof(addr);
+    if (getsockname(m_socket,
+                    reinterpret_cast<sockaddr*>(&addr), &len) == -1) {
+        m_port.unixError("Cannot get socket name");
+        m_port.restart();
+        return;
+    }
+
+    // Update IP/Port values
+    m_port.updateAddress(inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+    // Depends on type do listening or connection
+    if (server) {
+        if (listen(m_socket, SOMAXCONN) == -1) {
+            m_port.unixError("Listen error");
+            m_port.restart();
+            return;
+        }
+
+        // Keep listening socket for whole link lifetime
+        m_listenSocket = m_socket;
+        m_socket = 0;
+
+        // Wait for incoming connections
+        if (!m_loop.add(m_listenSocket, EPOLLIN,
+                        [this](uint32_t) { acceptConnection(); })) {
+            m_port.unixError("Event loop error");
+            closeListener();
+            m_port.restart();
+            return;
+        }
+    } else {
+        // Setup address for connection
+        sockaddr_in clientAddr;
+        memset(&clientAddr, 0, sizeof(clientAddr));
+        clientAddr.sin_family = AF_INET;
+        clientAddr.sin_addr.s_addr = inet_addr(m_port.getClientIP().c_str());
+        clientAddr.sin_port = htons(m_port.getClientPort());
+
+        // Update information
+        m_port.updateClientAddress(m_port.getClientIP(),
+                                   m_port.getClientPort());
+
+        int result = connect(m_socket,
+                             reinterpret_cast<const sockaddr*>(&clientAddr),
+                             sizeof(clientAddr));
+        if (result == 0) {
+            established();
+            return;
+        }
+
+        if (errno != EINPROGRESS) {
+            m_port.unixError("Connection error");
+            m_port.restart();
+            return;
+        }
+
+        // Wait until connection is finished
+        if (!m_loop.add(m_socket, EPOLLOUT,
+                        [this](uint32_t) { connectFinished(); })) {
+            m_port.unixError("Event loop error");
+            m_port.restart();
+            return;
+        }
+    }
+}
+
+void TcpLink::close()
+{
+    if (m_socket) {
+        m_loop.remove(m_socket);
+        shutdown(m_socket, SHUT_RDWR);
+        ::close(m_socket);
+        m_socket = 0;
+    }
+
+    // Listening socket stays bound, new peers wait in backlog
+    if (m_listenSocket) m_loop.remove(m_listenSocket);
+
+    // Drop pending messages
+    m_loop.cancelOperation(m_sendOperation);
+    m_sendOperation = 0;
+    m_sendQueue.clear();
+    m_sendOffset = 0;
+    m_sendQueued = 0;
+    m_sendPending = 0;
+}
+
+void TcpLink::acceptConnection()
+{
+    // Accept all pending peers
+    while (m_listenSocket) {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int result = accept4(m_listenSocket,
+                             reinterpret_cast<sockaddr*>(&addr), &len,
+                             SOCK_NONBLOCK);
+
+        if (result == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            m_port.unixError("Accept error");
+            closeListener();
+            m_port.restart();
+            return;
+        }
+
+        // First peer is handled by this port
+        if (!m_port.isConnected()) {
+            adopt(result, addr);
+            established();
+            continue;
+        }
+
+        // Other peers get their own logical ports
+        Port *peer = m_port.createPeerPort();
+        if (!peer) {
+            ::close(result);
+            m_port.portMsg("Peer rejected, port is already connected");
+            continue;
+        }
+
+        TcpLink *link = new TcpLink(*peer);
+        link->adopt(result, addr);
+        m_port.addPeerPort(peer, link);
+    }
+}
+
+void TcpLink::adopt(int socket, const sockaddr_in &addr)
+{
+    m_socket = socket;
+
+    // Get peer address and update UI
+    m_port.updateClientAddress(inet_ntoa(addr.sin_addr),
+                               ntohs(addr.sin_port));
+}
+
+void TcpLink::closeListener()
+{
+    if (m_listenSocket) {
+        m_loop.remove(m_listenSocket);
+        ::close(m_listenSocket);
+        m_listenSocket = 0;
+    }
+}
+
+void TcpLink::connectFinished()
+{
+    // Check result of non blocking connect
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+        m_port.unixError("Connection error");
+        m_port.restart();
+        return;
+    }
+
+    if (error != 0) {
+        errno = error;
+        m_port.unixError("Connection error");
+        m_port.restart();
+        return;
+    }
+
+    m_loop.remove(m_socket);
+    established();
+}
+
+void TcpLink::established()
+{
+    // Wait for incoming data
+    if (!m_loop.add(m_socket, EPOLLIN,
+                    [this](uint32_t events) { handleEvents(events); })) {
+        m_port.unixError("Event loop error");
+        m_port.restart();
+        return;
+    }
+
+    m_port.established();
+}
+
+void TcpLink::handleEvents(uint32_t events)
+{
+    if (events & EPOLLOUT)
+        writeMessages();
+
+    // Errors and hang ups are reported by recv
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        readMessage();
+}
+
+void TcpLink::readMessage()
+{
+    // Multishot polls report only new data, so read until socket is empty
+    bool drain = m_loop.getBackend() == EventLoop::Backend::URING;
+
+    do {
+        // Receive directly into frame decoder buffer
+        size_t space;
+        char *buffer = m_port.getReceiveBuffer(space);
+        ssize_t size = recv(m_socket, buffer, space, 0);
+
+        if (size == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            m_port.unixError("Socket read error");
+            m_port.restart();
+            return;
+        }
+
+        // Peer closed connection
+        if (size == 0) {
+            m_port.restart();
+            return;
+        }
+
+        m_port.received(buffer, size);
+    } while (drain && m_port.isConnected());
+}
+
+bool TcpLink::send(const char *msg, size_t size)
+{
+    // With io_uring messages are queued and written once per batch of
+    // events. Only data behind send in progress waits for kernel, other
+    // data is not seen by kernel yet and does not make port congested.
+    if (m_loop.getBackend() == EventLoop::Backend::URING) {
+        m_sendQueue.push_back(string(msg, size));
+        if (m_sendOperation) {
+            m_sendQueued += size;
+        } else {
+            m_sendPending += size;
+            if (m_sendPending >= SUBMIT_SIZE)
+                submitMessages();
+            else
+                scheduleSubmit();
+        }
+        return true;
+    }
+
+    // Try to send directly if nothing is waiting
+    size_t offset = 0;
+    if (m_sendQueue.empty()) {
+        ssize_t sent = ::send(m_socket, msg, size, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                m_port.unixError("Send error");
+                m_port.restartLater();
+                return false;
+            }
+            sent = 0;
+        }
+        if (static_cast<size_t>(sent) == size) return true;
+        offset = sent;
+
+        // Wait until socket is writable
+        m_loop.modify(m_socket, EPOLLIN | EPOLLOUT);
+        m_sendOffset = offset;
+    }
+
+    m_sendQueue.push_back(string(msg, size));
+    m_sendQueued += size - offset;
+    return true;
+}
+
+ssize_t TcpLink::writeQueue()
+{
+    size_t written = 0;
+    while (!m_sendQueue.empty()) {
+        // Gather as many queued messages as possible in one call
+        iovec iov[64];
+        int count = 0;
+        size_t total = 0;
+        size_t offset = m_sendOffset;
+        for (auto it = m_sendQueue.begin();
+             it != m_sendQueue.end() && count < 64; ++it, ++count) {
+            iov[count].iov_base = const_cast<char*>(it->data()) + offset;
+            iov[count].iov_len = it->length() - offset;
+            total += iov[count].iov_len;
+            offset = 0;
+        }
+
+        // Like writev, but without SIGPIPE
+        msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = count;
+
+        ssize_t size = sendmsg(m_socket, &hdr, MSG_NOSIGNAL);
+        if (size == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+
+        // Remove sent messages
+        size_t sent = size;
+        written += sent;
+        while (sent > 0) {
+            size_t left = m_sendQueue.front().length() - m_sendOffset;
+            if (sent < left) {
+                m_sendOffset += sent;
+                break;
+            }
+            sent -= left;
+            m_sendOffset = 0;
+            m_sendQueue.pop_front();
+        }
+
+        // Socket buffer is full
+        if (static_cast<size_t>(size) < total) break;
+    }
+    return written;
+}
+
+void TcpLink::writeMessages()
+{
+    ssize_t written = writeQueue();
+    if (written == -1) {
+        // Front message can be partially sent, so the rest of stream
+        // would follow a truncated frame. Queue is dropped on restart.
+        m_port.unixError("Send error");
+        m_loop.modify(m_socket, EPOLLIN);
+        m_port.restartLater();
+        return;
+    }
+
+    m_sendQueued -= written;
+    if (m_sendQueue.empty())
+        m_loop.modify(m_socket, EPOLLIN);
+
+    m_port.updateCongestion();
+}
+
+void TcpLink::scheduleSubmit()
+{
+    if (m_submitQueued) return;
+    m_submitQueued = true;
+
+    weak_ptr<bool> alive = m_alive;
+    m_loop.defer([this, alive]() {
+        if (alive.expired()) return;
+        m_submitQueued = false;
+        if (!m_sendOperation && !m_sendQueue.empty()) submitMessages();
+    });
+}
+
+void TcpLink::submitMessages()
+{
+    // Socket buffer takes what fits at once, like with epoll backend, so
+    // port is not congested by data kernel has not seen yet
+    bool written = writeQueue() != -1;
+    m_sendQueued = 0;
+    m_sendPending = 0;
+    if (!written) {
+        m_port.unixError("Send error");
+        m_port.restartLater();
+        return;
+    }
+    if (m_sendQueue.empty()) return;
+
+    // Join the rest, it is owned by loop until kernel takes all of it
+    string data;
+    for(auto &msg : m_sendQueue)
+        data += msg;
+    data.erase(0, m_sendOffset);
+    m_sendQueue.clear();
+    m_sendOffset = 0;
+
+    auto done = [this](int result, string &data) {
+        m_sendOperation = 0;
+
+        // Rest of stream would follow a truncated frame
+        if (result < 0) {
+            errno = -result;
+            m_port.unixError("Send error");
+            m_port.restartLater();
+            return;
+        }
+
+        // Unsent part goes before messages queued in the meantime
+        if (static_cast<size_t>(result) < data.size())
+            m_sendQueue.push_front(data.substr(result));
+        if (!m_sendQueue.empty()) submitMessages();
+        m_port.updateCongestion();
+    };
+
+    m_sendOperation = m_loop.send(m_socket, move(data), done);
+    if (!m_sendOperation) {
+        m_port.portMsg("Send submission error");
+        m_port.restartLater();
+    }
+}
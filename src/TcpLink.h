@@ -0,0 +1,67 @@
+#ifndef TCP_LINK_H
+#define TCP_LINK_H
+#include "Link.h"
+#include "EventLoop.h"
+#include <arpa/inet.h>
+#include <deque>
+#include <memory>
+#include <string>
+
+// Stream link. Server link keeps its listening socket for whole lifetime,
+// first peer is served by its own port, others get peer ports.
+class TcpLink : public Link
+{
+public:
+    TcpLink(Port &port);
+    ~TcpLink();
+
+    void open();
+    void close();
+    bool isListening() const {
+        return m_listenSocket != 0;
+    }
+
+    bool send(const char *msg, size_t size);
+    size_t getQueuedBytes() const {
+        return m_sendQueued;
+    }
+
+    // Use already connected socket (peer accepted by other link)
+    void adopt(int socket, const sockaddr_in &addr);
+
+private:
+
+    void acceptConnection();
+    void connectFinished();
+    void established();
+    void closeListener();
+    void handleEvents(uint32_t events);
+    void readMessage();
+    ssize_t writeQueue();
+    void writeMessages();
+    void scheduleSubmit();
+    void submitMessages();
+
+    EventLoop &m_loop;
+
+    int m_listenSocket;
+    int m_socket;
+
+    // Outbound queue, front message can be partially sent
+    std::deque<std::string> m_sendQueue;
+    size_t m_sendOffset;
+    size_t m_sendQueued;
+
+    // With io_uring backend data sent while handling events is pending
+    // until the end of the batch, then socket takes what fits and the rest
+    // is sent by kernel. Only data waiting behind such send counts for
+    // congestion.
+    EventLoop::OperationID m_sendOperation;
+    size_t m_sendPending;
+    bool m_submitQueued;
+
+    // Deferred submission checks if link still exists
+    std::shared_ptr<bool> m_alive;
+};
+
+#endif //TCP_LINK_H
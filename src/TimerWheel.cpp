@@ -0,0 +1,170 @@
+#include "TimerWheel.h"
+#include <algorithm>
+using namespace std;
+
+TimerWheel::TimerWheel(unsigned long now)
+    : m_current(now), m_count(0)
+{
+    for (uint32_t &head : m_heads) head = NONE;
+    for (uint64_t &slots : m_occupied) slots = 0;
+}
+
+TimerWheel::TimerID TimerWheel::add(unsigned long expires, const Task &task)
+{
+    uint32_t index = m_heads[FREE];
+    if (index != NONE) {
+        unlink(index);
+    } else {
+        index = m_entries.size();
+        m_entries.push_back(Entry());
+        m_entries[index].generation = 1;
+    }
+
+    Entry &entry = m_entries[index];
+    entry.task = task;
+    entry.expires = expires;
+    place(index);
+    ++m_count;
+
+    return static_cast<TimerID>(entry.generation) << 32 | (index + 1);
+}
+
+void TimerWheel::cancel(TimerID id)
+{
+    uint32_t index = static_cast<uint32_t>(id) - 1;
+    if (index >= m_entries.size()) return;
+
+    Entry &entry = m_entries[index];
+    if (entry.generation != id >> 32 || entry.list == FREE) return;
+
+    unlink(index);
+    release(index);
+    --m_count;
+}
+
+void TimerWheel::advance(unsigned long now)
+{
+    while (m_count) {
+        unsigned long time = next();
+        if (time > now) break;
+
+        // Move timers of slots starting now to lower levels, from
+        // level 0 expired ones go to due list
+        if (time > m_current) {
+            m_current = time;
+            if (!(time & RANGE)) cascade(OVERFLOW);
+            for (unsigned level = LEVELS; level-- > 0; ) {
+                unsigned shift = level * SLOT_BITS;
+                if (time & ((1UL << shift) - 1)) continue;
+                cascade(level * SLOTS + ((time >> shift) & (SLOTS - 1)));
+            }
+        }
+
+        // Task can add and cancel timers, even due ones
+        while (m_heads[DUE] != NONE) {
+            uint32_t index = m_heads[DUE];
+            unlink(index);
+            Task task = move(m_entries[index].task);
+            release(index);
+            --m_count;
+            task();
+        }
+    }
+
+    // There is nothing to do until next(), so time can jump
+    if (now > m_current) m_current = now;
+}
+
+unsigned long TimerWheel::next() const
+{
+    if (!m_count) return 0;
+    if (m_heads[DUE] != NONE) return m_current;
+
+    // Slots of each level after the current one, slot of higher level
+    // has to be handled when it starts
+    unsigned long time = ~0UL;
+    if (m_heads[OVERFLOW] != NONE)
+        time = (m_current | RANGE) + 1;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        unsigned shift = level * SLOT_BITS;
+        unsigned current = (m_current >> shift) & (SLOTS - 1);
+        if (current == SLOTS - 1) continue;
+
+        uint64_t slots = m_occupied[level] & (~0ULL << (current + 1));
+        if (!slots) continue;
+
+        unsigned long slot = __builtin_ctzll(slots);
+        unsigned long base = m_current >> (shift + SLOT_BITS)
+                                       << (shift + SLOT_BITS);
+        time = min(time, base | slot << shift);
+    }
+    return time;
+}
+
+void TimerWheel::place(uint32_t index)
+{
+    unsigned long expires = m_entries[index].expires;
+    if (expires <= m_current) {
+        link(index, DUE);
+        return;
+    }
+
+    // Timers beyond range of the wheel are placed again when it wraps
+    unsigned long diff = expires ^ m_current;
+    if (diff > RANGE) {
+        link(index, OVERFLOW);
+        return;
+    }
+
+    unsigned level = (63 - __builtin_clzl(diff)) / SLOT_BITS;
+    unsigned slot = (expires >> (level * SLOT_BITS)) & (SLOTS - 1);
+    link(index, level * SLOTS + slot);
+}
+
+void TimerWheel::link(uint32_t index, uint32_t list)
+{
+    Entry &entry = m_entries[index];
+    entry.list = list;
+    entry.prev = NONE;
+    entry.next = m_heads[list];
+    if (entry.next != NONE) m_entries[entry.next].prev = index;
+    m_heads[list] = index;
+
+    if (list < OVERFLOW) m_occupied[list / SLOTS] |= 1ULL << (list % SLOTS);
+}
+
+void TimerWheel::unlink(uint32_t index)
+{
+    Entry &entry = m_entries[index];
+    if (entry.prev != NONE)
+        m_entries[entry.prev].next = entry.next;
+    else
+        m_heads[entry.list] = entry.next;
+    if (entry.next != NONE) m_entries[entry.next].prev = entry.prev;
+
+    if (entry.list < OVERFLOW && m_heads[entry.list] == NONE)
+        m_occupied[entry.list / SLOTS] &= ~(1ULL << (entry.list % SLOTS));
+}
+
+void TimerWheel::release(uint32_t index)
+{
+    Entry &entry = m_entries[index];
+    entry.task = nullptr;
+    ++entry.generation;
+    link(index, FREE);
+}
+
+void TimerWheel::cascade(uint32_t list)
+{
+    // Detach whole list, timers are placed again relative to current time
+    uint32_t index = m_heads[list];
+    m_heads[list] = NONE;
+    if (list < OVERFLOW)
+        m_occupied[list / SLOTS] &= ~(1ULL << (list % SLOTS));
+
+    while (index != NONE) {
+        uint32_t next = m_entries[index].next;
+        place(index);
+        index = next;
+    }
+}
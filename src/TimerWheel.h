@@ -0,0 +1,78 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hierarchical timing wheel with millisecond ticks. Level l has 64 slots
+// of 64^l ticks, timer is kept on level of highest 6 bit group in which
+// its expiry differs from current time. When time reaches slot of higher
+// level its timers are moved to lower levels, so adding and cancelling
+// are O(1) and each timer is moved at most once per level.
+//
+// Timers are kept in one vector and linked by indices. Identifier holds
+// generation of the entry, so cancelling expired timer is harmless.
+class TimerWheel
+{
+public:
+    typedef unsigned long TimerID;
+    typedef std::function<void()> Task;
+
+    // Times are absolute milliseconds of monotonic clock
+    TimerWheel(unsigned long now = 0);
+
+    // Returned id is never 0. Timers which already expired run on next
+    // advance().
+    TimerID add(unsigned long expires, const Task &task);
+    void cancel(TimerID id);
+
+    // Run timers expired before or at given time
+    void advance(unsigned long now);
+
+    // Time when wheel has to be advanced again, 0 if there are no timers
+    unsigned long next() const;
+
+    bool empty() const {
+        return m_count == 0;
+    }
+
+private:
+
+    static const unsigned LEVELS = 5;
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1 << SLOT_BITS;
+
+    // Largest difference of times kept in the wheel
+    static const unsigned long RANGE = (1UL << (LEVELS * SLOT_BITS)) - 1;
+
+    // Lists of timers beyond range of the wheel, of expired timers and of
+    // free entries follow wheel slots
+    static const uint32_t OVERFLOW = LEVELS * SLOTS;
+    static const uint32_t DUE = OVERFLOW + 1;
+    static const uint32_t FREE = DUE + 1;
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        Task task;
+        unsigned long expires;
+        uint32_t generation;
+        uint32_t list;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    void place(uint32_t index);
+    void link(uint32_t index, uint32_t list);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(uint32_t list);
+
+    std::vector<Entry> m_entries;
+    uint32_t m_heads[FREE + 1];
+    uint64_t m_occupied[LEVELS];
+    unsigned long m_current;
+    size_t m_count;
+};
+
+#endif //TIMER_WHEEL_H
@@ -0,0 +1,128 @@
+#include "URing.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+using namespace std;
+
+URing::URing()
+    : m_fd(-1), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED), m_sqRingSize(0),
+      m_cqRingSize(0), m_sqHead(nullptr), m_sqTail(nullptr),
+      m_sqMask(nullptr), m_sqArray(nullptr), m_sqEntries(0),
+      m_sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), m_sqLocalTail(0),
+      m_toSubmit(0), m_cqHead(nullptr), m_cqTail(nullptr), m_cqMask(nullptr),
+      m_cqes(nullptr)
+{
+
+}
+
+URing::~URing()
+{
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqEntries * sizeof(io_uring_sqe));
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED)
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+bool URing::setup(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Multishot polls can produce many completions per submission
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 8;
+
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd == -1) return false;
+
+    // Map submission and completion rings
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes +
+                   params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (m_cqRingSize > m_sqRingSize) m_sqRingSize = m_cqRingSize;
+        m_cqRingSize = m_sqRingSize;
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) return false;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) return false;
+    }
+
+    m_sqEntries = params.sq_entries;
+    m_sqes = static_cast<io_uring_sqe*>(
+        mmap(nullptr, m_sqEntries * sizeof(io_uring_sqe),
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+             IORING_OFF_SQES));
+    if (m_sqes == MAP_FAILED) return false;
+
+    char *sq = static_cast<char*>(m_sqRing);
+    m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    m_sqLocalTail = *m_sqTail;
+
+    char *cq = static_cast<char*>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+io_uring_sqe* URing::getSQE()
+{
+    // Flush queue if it is full
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqLocalTail - head >= m_sqEntries) {
+        submit(0);
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqLocalTail - head >= m_sqEntries) return nullptr;
+    }
+
+    unsigned index = m_sqLocalTail & *m_sqMask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+
+    ++m_sqLocalTail;
+    ++m_toSubmit;
+    return sqe;
+}
+
+int URing::submit(unsigned waitNr)
+{
+    // Publish prepared entries to kernel
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+
+    unsigned flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+    int result = syscall(__NR_io_uring_enter, m_fd, m_toSubmit, waitNr,
+                         flags, nullptr, 0);
+    if (result > 0) m_toSubmit -= result;
+    return result;
+}
+
+bool URing::peek(io_uring_cqe &cqe)
+{
+    unsigned head = *m_cqHead;
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) return false;
+
+    cqe = m_cqes[head & *m_cqMask];
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef URING_H
+#define URING_H
+#include <linux/io_uring.h>
+#include <cstddef>
+
+// Minimal io_uring wrapper on top of raw system calls. Submission entries
+// are collected by getSQE() and passed to kernel in one submit() call.
+class URing
+{
+public:
+    URing();
+    ~URing();
+
+    // Returns false if io_uring is not supported
+    bool setup(unsigned entries);
+
+    // Get cleared submission entry, returns nullptr if queue is full
+    io_uring_sqe* getSQE();
+
+    // Submit queued entries and wait for at least waitNr completions
+    int submit(unsigned waitNr);
+
+    // Copy next completion, returns false if there is nothing to reap
+    bool peek(io_uring_cqe &cqe);
+
+private:
+
+    int m_fd;
+
+    void *m_sqRing;
+    void *m_cqRing;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+
+    unsigned *m_sqHead;
+    unsigned *m_sqTail;
+    unsigned *m_sqMask;
+    unsigned *m_sqArray;
+    unsigned m_sqEntries;
+    io_uring_sqe *m_sqes;
+    unsigned m_sqLocalTail;
+    unsigned m_toSubmit;
+
+    unsigned *m_cqHead;
+    unsigned *m_cqTail;
+    unsigned *m_cqMask;
+    io_uring_cqe *m_cqes;
+};
+
+#endif //URING_H
@@ -0,0 +1,438 @@
+#include "UdpLink.h"
+#include "Port.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+using namespace std;
+
+// Datagrams received and sent with one system call
+static const int BATCH_SIZE = 32;
+
+// Pending datagrams are flushed before the end of batch when they grow
+// this large, so sending loops cannot queue without limit
+static const size_t FLUSH_SIZE = 256 * 1024;
+
+// Every datagram carries one frame, so slot fits largest frame (any MTU
+// accepted by clients). Longer datagrams are truncated and dropped.
+static const size_t DATAGRAM_SIZE = FRAME_HEADER_SIZE + FRAME_MAX_SIZE;
+
+UdpSocket::UdpSocket(EventLoop &loop)
+    : m_loop(loop), m_socket(0), m_connected(false), m_listener(nullptr),
+      m_receiveBuffer(BATCH_SIZE * DATAGRAM_SIZE), m_queued(0), m_pending(0),
+      m_flushQueued(false)
+{
+
+}
+
+UdpSocket::~UdpSocket()
+{
+    if (m_socket) {
+        m_loop.remove(m_socket);
+        ::close(m_socket);
+    }
+}
+
+bool UdpSocket::open(unsigned port, sockaddr_in &addr)
+{
+    m_socket = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_IP);
+    if (m_socket == -1) {
+        m_socket = 0;
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&addr),
+             sizeof(addr)) == -1)
+        return false;
+
+    socklen_t len = sizeof(addr);
+    if (getsockname(m_socket,
+                    reinterpret_cast<sockaddr*>(&addr), &len) == -1)
+        return false;
+
+    return m_loop.add(m_socket, EPOLLIN,
+                      [this](uint32_t events) { handleEvents(events); });
+}
+
+bool UdpSocket::connect(sockaddr_in &addr)
+{
+    if (::connect(m_socket, reinterpret_cast<const sockaddr*>(&addr),
+                  sizeof(addr)) == -1)
+        return false;
+
+    // Any address is connected to local host, datagrams come from there
+    socklen_t len = sizeof(addr);
+    if (getpeername(m_socket, reinterpret_cast<sockaddr*>(&addr), &len) == -1)
+        return false;
+
+    m_connected = true;
+    return true;
+}
+
+uint64_t UdpSocket::key(const sockaddr_in &addr)
+{
+    return (static_cast<uint64_t>(ntohl(addr.sin_addr.s_addr)) << 16) |
+           ntohs(addr.sin_port);
+}
+
+void UdpSocket::attach(const sockaddr_in &addr, UdpLink *link)
+{
+    m_links[key(addr)] = link;
+}
+
+void UdpSocket::detach(const sockaddr_in &addr)
+{
+    m_links.erase(key(addr));
+}
+
+void UdpSocket::handleEvents(uint32_t events)
+{
+    // Links can release socket while handling datagrams
+    shared_ptr<UdpSocket> self = shared_from_this();
+
+    if (events & EPOLLOUT)
+        flush();
+
+    // Errors (e.g. refused connection) are reported by recvmmsg
+    if (events & (EPOLLIN | EPOLLERR))
+        receive();
+}
+
+void UdpSocket::receive()
+{
+    // Multishot polls report only new data, so read until socket is empty
+    bool drain = m_loop.getBackend() == EventLoop::Backend::URING;
+
+    mmsghdr msgs[BATCH_SIZE];
+    iovec iov[BATCH_SIZE];
+    sockaddr_in addrs[BATCH_SIZE];
+
+    while (true) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BATCH_SIZE; ++i) {
+            iov[i].iov_base = &m_receiveBuffer[i * DATAGRAM_SIZE];
+            iov[i].iov_len = DATAGRAM_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        int count = recvmmsg(m_socket, msgs, BATCH_SIZE, 0, nullptr);
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR) continue;
+            failed();
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+
+            const char *data = &m_receiveBuffer[i * DATAGRAM_SIZE];
+            size_t size = msgs[i].msg_len;
+
+            auto it = m_links.find(key(addrs[i]));
+            if (it != m_links.end())
+                it->second->datagram(data, size);
+            else if (m_listener)
+                m_listener->accept(addrs[i], data, size);
+        }
+
+        if (count < BATCH_SIZE && !drain) return;
+    }
+}
+
+void UdpSocket::send(const sockaddr_in &addr, const char *msg, size_t size)
+{
+    Datagram datagram;
+    datagram.addr = addr;
+    datagram.data.assign(msg, size);
+    m_sendQueue.push_back(move(datagram));
+    if (m_queued) {
+        m_queued += size;
+    } else {
+        m_pending += size;
+        if (m_pending >= FLUSH_SIZE) {
+            flush();
+            return;
+        }
+    }
+
+    // Datagrams sent while handling events go out in one batch
+    if (!m_flushQueued) {
+        m_flushQueued = true;
+        shared_ptr<UdpSocket> self = shared_from_this();
+        m_loop.defer([self]() { self->flush(); });
+    }
+}
+
+void UdpSocket::flush()
+{
+    m_flushQueued = false;
+
+    size_t sent = 0;
+    bool error = false;
+    while (sent < m_sendQueue.size()) {
+        mmsghdr msgs[BATCH_SIZE];
+        iovec iov[BATCH_SIZE];
+        memset(msgs, 0, sizeof(msgs));
+
+        int count = 0;
+        for (size_t i = sent; i < m_sendQueue.size() && count < BATCH_SIZE;
+             ++i, ++count) {
+            Datagram &datagram = m_sendQueue[i];
+            iov[count].iov_base = const_cast<char*>(datagram.data.data());
+            iov[count].iov_len = datagram.data.size();
+            msgs[count].msg_hdr.msg_iov = &iov[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+
+            // Connected socket has fixed destination
+            if (!m_connected) {
+                msgs[count].msg_hdr.msg_name = &datagram.addr;
+                msgs[count].msg_hdr.msg_namelen = sizeof(datagram.addr);
+            }
+        }
+
+        int result = sendmmsg(m_socket, msgs, count, 0);
+        if (result == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+
+            // Datagrams are unreliable anyway, drop whole queue
+            error = true;
+            sent = m_sendQueue.size();
+            break;
+        }
+        sent += result;
+    }
+
+    int savedErrno = errno;
+    m_sendQueue.erase(m_sendQueue.begin(), m_sendQueue.begin() + sent);
+    m_pending = 0;
+    m_queued = 0;
+    for(auto &datagram : m_sendQueue)
+        m_queued += datagram.data.size();
+
+    // Wait until socket is writable
+    m_loop.modify(m_socket, m_sendQueue.empty() ? EPOLLIN
+                                                : EPOLLIN | EPOLLOUT);
+
+    for(auto &link : m_links)
+        link.second->flushed();
+
+    if (error) {
+        errno = savedErrno;
+        failed();
+    }
+}
+
+void UdpSocket::failed()
+{
+    // Every link using socket has to be restarted. Copy them, links
+    // detach themselves while restarting.
+    vector<UdpLink*> links;
+    for(auto &link : m_links)
+        links.push_back(link.second);
+    if (m_listener && m_links.empty())
+        links.push_back(m_listener);
+
+    int savedErrno = errno;
+    for(auto link : links) {
+        errno = savedErrno;
+        link->failed();
+    }
+}
+
+UdpLink::UdpLink(Port &port)
+    : Link(port), m_loop(port.getLoop()), m_listening(false),
+      m_hasPeer(false), m_established(false), m_keepaliveTimer(0),
+      m_silent(0)
+{
+    memset(&m_peerAddr, 0, sizeof(m_peerAddr));
+}
+
+UdpLink::~UdpLink()
+{
+    m_listening = false;
+    if (m_socket && m_socket->getListener() == this)
+        m_socket->setListener(nullptr);
+    close();
+}
+
+void UdpLink::open()
+{
+    // Peer adopted from server link is already known
+    if (m_hasPeer && m_socket) {
+        established();
+        return;
+    }
+
+    // Socket is already bound, wait for peers again
+    if (m_listening) {
+        m_socket->setListener(this);
+        return;
+    }
+
+    shared_ptr<UdpSocket> socket = make_shared<UdpSocket>(m_loop);
+    sockaddr_in addr;
+    if (!socket->open(m_port.getPort(), addr)) {
+        m_port.unixError("Cannot bind a socket");
+        m_port.restart();
+        return;
+    }
+    m_socket = socket;
+
+    // Update IP/Port values
+    m_port.updateAddress(inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+    if (m_port.getConnectionType() == Port::ConnectionType::SERVER) {
+        m_listening = true;
+        m_socket->setListener(this);
+        return;
+    }
+
+    // Setup address for connection
+    m_peerAddr.sin_family = AF_INET;
+    m_peerAddr.sin_addr.s_addr = inet_addr(m_port.getClientIP().c_str());
+    m_peerAddr.sin_port = htons(m_port.getClientPort());
+    m_port.updateClientAddress(m_port.getClientIP(), m_port.getClientPort());
+
+    if (!m_socket->connect(m_peerAddr)) {
+        m_port.unixError("Connection error");
+        m_port.restart();
+        return;
+    }
+
+    m_hasPeer = true;
+    m_socket->attach(m_peerAddr, this);
+
+    // Let server know about us, link is established when it answers
+    m_silent = 0;
+    keepalive();
+}
+
+void UdpLink::close()
+{
+    m_loop.cancelTimer(m_keepaliveTimer);
+    m_keepaliveTimer = 0;
+    m_established = false;
+    if (!m_socket) return;
+
+    if (m_hasPeer) m_socket->detach(m_peerAddr);
+    m_hasPeer = false;
+
+    // Server socket stays bound, but ignores new peers
+    if (m_listening) {
+        m_socket->setListener(nullptr);
+        return;
+    }
+    m_socket.reset();
+}
+
+bool UdpLink::isListening() const
+{
+    return m_listening;
+}
+
+bool UdpLink::send(const char *msg, size_t size)
+{
+    if (!m_hasPeer) return false;
+    m_socket->send(m_peerAddr, msg, size);
+    return true;
+}
+
+size_t UdpLink::getQueuedBytes() const
+{
+    return m_socket ? m_socket->getQueuedBytes() : 0;
+}
+
+void UdpLink::adopt(const shared_ptr<UdpSocket> &socket,
+                    const sockaddr_in &addr)
+{
+    m_socket = socket;
+    m_peerAddr = addr;
+    m_hasPeer = true;
+    m_socket->attach(m_peerAddr, this);
+
+    // Get peer address and update UI
+    m_port.updateClientAddress(inet_ntoa(addr.sin_addr),
+                               ntohs(addr.sin_port));
+}
+
+void UdpLink::datagram(const char *data, size_t size)
+{
+    m_silent = 0;
+
+    // First answer of server
+    if (!m_established) established();
+
+    // Empty datagrams only keep link alive
+    if (size == 0 || !m_established) return;
+    m_port.receivedFrame(data, size);
+}
+
+void UdpLink::accept(const sockaddr_in &addr, const char *data, size_t size)
+{
+    // First peer is handled by this port
+    if (!m_hasPeer) {
+        adopt(m_socket, addr);
+        datagram(data, size);
+        return;
+    }
+
+    // Other peers get their own logical ports
+    Port *peer = m_port.createPeerPort();
+    if (!peer) {
+        m_port.portMsg("Peer rejected, port is already connected");
+        return;
+    }
+
+    UdpLink *link = new UdpLink(*peer);
+    link->adopt(m_socket, addr);
+    if (m_port.addPeerPort(peer, link))
+        link->datagram(data, size);
+}
+
+void UdpLink::failed()
+{
+    m_port.unixError("Connection error");
+    m_port.restart();
+}
+
+void UdpLink::flushed()
+{
+    m_port.updateCongestion();
+}
+
+void UdpLink::established()
+{
+    m_established = true;
+    m_silent = 0;
+
+    // Answer peer at once, then keep link alive
+    if (!m_keepaliveTimer) keepalive();
+    m_port.established();
+}
+
+void UdpLink::keepalive()
+{
+    m_keepaliveTimer = 0;
+
+    // Nothing has been received for a few intervals
+    if (m_silent++ >= KEEPALIVE_LIMIT) {
+        m_port.portMsg("Peer is not responding");
+        m_port.restart();
+        return;
+    }
+
+    m_socket->send(m_peerAddr, "", 0);
+    m_keepaliveTimer = m_loop.setTimer(KEEPALIVE_INTERVAL,
+                                       [this]() { keepalive(); });
+}
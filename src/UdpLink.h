@@ -0,0 +1,123 @@
+#ifndef UDP_LINK_H
+#define UDP_LINK_H
+#include "Link.h"
+#include "EventLoop.h"
+#include <arpa/inet.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class UdpLink;
+
+// Datagram socket shared by server link and its peer links. Received
+// datagrams are dispatched by source address, datagrams from unknown
+// sources go to the listening link. Sends are queued and flushed with one
+// sendmmsg after current batch of events.
+class UdpSocket : public std::enable_shared_from_this<UdpSocket>
+{
+public:
+    UdpSocket(EventLoop &loop);
+    ~UdpSocket();
+
+    // Bind socket to local port (0 chooses any), returns bound address
+    bool open(unsigned port, sockaddr_in &addr);
+
+    // Receive only from given address, it is updated to actual peer
+    bool connect(sockaddr_in &addr);
+
+    void attach(const sockaddr_in &addr, UdpLink *link);
+    void detach(const sockaddr_in &addr);
+    void setListener(UdpLink *link) {
+        m_listener = link;
+    }
+    UdpLink* getListener() const {
+        return m_listener;
+    }
+
+    void send(const sockaddr_in &addr, const char *msg, size_t size);
+    size_t getQueuedBytes() const {
+        return m_queued;
+    }
+
+private:
+
+    struct Datagram {
+        sockaddr_in addr;
+        std::string data;
+    };
+
+    static uint64_t key(const sockaddr_in &addr);
+
+    void handleEvents(uint32_t events);
+    void receive();
+    void flush();
+    void failed();
+
+    EventLoop &m_loop;
+    int m_socket;
+    bool m_connected;
+
+    std::unordered_map<uint64_t, UdpLink*> m_links;
+    UdpLink *m_listener;
+    std::vector<char> m_receiveBuffer;
+
+    // Outbound datagrams waiting for flush. Only datagrams socket did not
+    // take (and ones queued behind them) count for congestion, others are
+    // pending until the end of the batch.
+    std::vector<Datagram> m_sendQueue;
+    size_t m_queued;
+    size_t m_pending;
+    bool m_flushQueued;
+};
+
+// Connectionless link, one frame per datagram. Peers exchange empty
+// keepalive datagrams and link is considered dead after few silent
+// intervals. Client link is established when first datagram arrives.
+class UdpLink : public Link
+{
+public:
+    UdpLink(Port &port);
+    ~UdpLink();
+
+    void open();
+    void close();
+    bool isListening() const;
+
+    bool send(const char *msg, size_t size);
+    size_t getQueuedBytes() const;
+
+    // Use socket of server link for peer with given address
+    void adopt(const std::shared_ptr<UdpSocket> &socket,
+               const sockaddr_in &addr);
+
+    // Socket events
+    void datagram(const char *data, size_t size);
+    void accept(const sockaddr_in &addr, const char *data, size_t size);
+    void failed();
+    void flushed();
+
+private:
+
+    void established();
+    void keepalive();
+
+    static const unsigned KEEPALIVE_INTERVAL = 1000;
+    static const unsigned KEEPALIVE_LIMIT = 3;
+
+    EventLoop &m_loop;
+    std::shared_ptr<UdpSocket> m_socket;
+
+    // Server link keeps its socket bound between peers
+    bool m_listening;
+
+    sockaddr_in m_peerAddr;
+    bool m_hasPeer;
+    bool m_established;
+
+    EventLoop::TimerID m_keepaliveTimer;
+    unsigned m_silent;
+};
+
+#endif //UDP_LINK_H